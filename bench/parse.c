@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: MIT
+/* Parse throughput of each scanner path (scalar, SSE2, AVX2) on
+ * generated decks of a few hundred MB, one ASCII and one with multibyte
+ * UTF-8 prompts.
+ *
+ *   bin/bench-parse [MiB]
+ */
+#include "parser.h"
+#include "scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_DEFAULT_MIB 256U
+#define BENCH_MAX_MIB 65536U
+#define BENCH_RUNS 3U
+#define BENCH_CHUNK (1024U * 1024U)
+#define BENCH_ITEMS_PER_GROUP 40U
+
+static int write_all(int fd, const char* p, size_t len) {
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (len == 0)
+      break;
+    ssize_t n = write(fd, p, len);
+
+    if (n <= 0)
+      return -1;
+    p += (size_t)n;
+    len -= (size_t)n;
+  }
+  return (len == 0) ? 0 : -1;
+}
+
+static const char* const g_prompts[] = {
+    "What is item %u of group %u?  answer %u\n",
+    "Что такое пункт %u группы %u? — ответ %u ✓\n",
+};
+static const char* const g_deck_names[] = {"ascii", "utf-8"};
+
+/* Groups of BENCH_ITEMS_PER_GROUP prompts with a comment and a blank
+ * line now and then, until at least `bytes` are written.
+ */
+static int write_deck(int fd, u64 bytes, const char* prompt) {
+  static char buf[BENCH_CHUNK + MAX_LINE_LEN];
+  u64 written = 0;
+  size_t used = 0;
+
+  for (u32 g = 0; g < MAX_GROUPS; g++) {
+    if (written + used >= bytes)
+      break;
+    if (g % 16U == 0)
+      used += (size_t)snprintf(
+          buf + used, sizeof(buf) - used, "\n# section %u\n", g / 16U);
+    used += (size_t)snprintf(
+        buf + used, sizeof(buf) - used, "[Group %u | 30]\n", g);
+    for (u32 i = 0; i < BENCH_ITEMS_PER_GROUP; i++)
+      used += (size_t)snprintf(buf + used,
+          sizeof(buf) - used,
+          prompt,
+          i,
+          g,
+          g * 7U + i);
+    if (used >= BENCH_CHUNK) {
+      if (write_all(fd, buf, used) != 0)
+        return -1;
+      written += used;
+      used = 0;
+    }
+  }
+  return write_all(fd, buf, used);
+}
+
+/* Best parse time of BENCH_RUNS runs at `level`. */
+static int bench_level(
+    const char* path, enum scan_level level, u64* best_ns, u64* bytes) {
+  static struct Session session;
+  struct ParseOptions opts;
+  char err[256];
+
+  memset(&opts, 0, sizeof(opts));
+  scan_limit(level);
+  *best_ns = 0;
+  for (unsigned run = 0; run < BENCH_RUNS; run++) {
+    if (parse_session_file(path, &opts, &session, err, sizeof(err)) != 0) {
+      fprintf(stderr, "parse failed: %s\n", err);
+      return -1;
+    }
+    if (*best_ns == 0 || session.parse_ns < *best_ns)
+      *best_ns = session.parse_ns;
+    *bytes = (u64)session.text_len;
+    if (session_release(&session) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* Writes a deck of `prompt` lines and prints each level's throughput. */
+static int bench_deck(u64 bytes, const char* prompt, const char* name) {
+  const char* dir = getenv("TMPDIR");
+  char path[512];
+
+  if (!dir || dir[0] == '\0')
+    dir = "/tmp";
+  if ((size_t)snprintf(path, sizeof(path), "%s/cram-bench-XXXXXX", dir) >=
+      sizeof(path))
+    return -1;
+
+  int fd = mkstemp(path);
+
+  if (fd < 0) {
+    perror("mkstemp");
+    return -1;
+  }
+
+  int rc = write_deck(fd, bytes, prompt);
+
+  if (close(fd) != 0 || rc != 0) {
+    fprintf(stderr, "failed to write %s\n", path);
+    (void)unlink(path);
+    return -1;
+  }
+
+  enum scan_level top = scan_detect();
+
+  for (int level = SCAN_SCALAR; level <= (int)top; level++) {
+    u64 ns = 0;
+    u64 len = 0;
+
+    rc = bench_level(path, (enum scan_level)level, &ns, &len);
+    if (rc != 0)
+      break;
+    printf("parse %-5s %-6s %7.2f GB/s  (%llu MB, best of %u)\n",
+        name,
+        scan_level_name((enum scan_level)level),
+        (ns > 0) ? (double)len / (double)ns : 0.0,
+        (unsigned long long)(len / 1000000U),
+        BENCH_RUNS);
+  }
+  scan_limit(SCAN_AVX2);
+  (void)unlink(path);
+  return rc;
+}
+
+int main(int argc, char** argv) {
+  unsigned long mib = BENCH_DEFAULT_MIB;
+
+  if (argc > 1)
+    mib = strtoul(argv[1], NULL, 10);
+  if (mib == 0 || mib > BENCH_MAX_MIB) {
+    fprintf(stderr, "usage: %s [MiB 1..%u]\n", argv[0], BENCH_MAX_MIB);
+    return 2;
+  }
+
+  int rc = 0;
+
+  for (size_t d = 0; d < sizeof(g_prompts) / sizeof(g_prompts[0]); d++) {
+    rc = bench_deck((u64)mib * 1024U * 1024U, g_prompts[d], g_deck_names[d]);
+    if (rc != 0)
+      break;
+  }
+  return (rc == 0) ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: MIT
+/* Throughput of the shuffle paths on 1K, 64K and 1M entries, best of
+ * BENCH_RUNS runs: rng_shuffle on a stored array, rng_order_draw over
+ * every position of a round (a watched deck), and a keyed permutation
+ * picked and read out in full (an unwatched one).
+ *
+ *   bin/bench-shuffle
+ */
+#include "rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_RUNS 5U
+#define BENCH_MIN_ELEMENTS (1U << 24)
+
+static const u32 g_sizes[] = {1024U, 65536U, 1048576U};
+
+static double now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0.0;
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Keeps the result of a pass live without printing it. */
+static volatile u32 g_sink;
+
+static int pass_shuffle(struct Rng* rng, struct ShuffleOrder* order, u32 n) {
+  if (rng_shuffle(rng, order->values, n) != 0)
+    return -1;
+  g_sink ^= order->values[n / 2U];
+  return 0;
+}
+
+static int pass_order(struct Rng* rng, struct ShuffleOrder* order, u32 n) {
+  u32 value = 0;
+
+  if (rng_order_reset(order) != 0)
+    return -1;
+  for (u32 pos = 0; pos < n; pos++) {
+    if (rng_order_draw(rng, order, pos, n, &value) != 0)
+      return -1;
+  }
+  g_sink ^= value;
+  return 0;
+}
+
+static int pass_perm(struct Rng* rng, struct ShuffleOrder* order, u32 n) {
+  struct Permutation perm;
+  u32 acc = 0;
+
+  (void)order;
+  if (rng_perm_init(&perm, rng, n) != 0)
+    return -1;
+  for (u32 pos = 0; pos < n; pos++)
+    acc ^= rng_perm_at(&perm, pos);
+  g_sink ^= acc;
+  return 0;
+}
+
+enum pass_kind { PASS_ARRAY, PASS_ORDER, PASS_PERM, PASS_COUNT };
+
+static const char* const g_pass_names[PASS_COUNT] = {"array", "order", "perm"};
+
+static int run_pass(
+    enum pass_kind kind, struct Rng* rng, struct ShuffleOrder* order, u32 n) {
+  switch (kind) {
+  case PASS_ARRAY:
+    return pass_shuffle(rng, order, n);
+  case PASS_ORDER:
+    return pass_order(rng, order, n);
+  case PASS_PERM:
+    return pass_perm(rng, order, n);
+  default:
+    return -1;
+  }
+}
+
+static int bench_pass(enum pass_kind kind,
+    struct Rng* rng,
+    struct ShuffleOrder* order,
+    u32 n) {
+  u32 reps = BENCH_MIN_ELEMENTS / n;
+  double best = 0.0;
+
+  for (u32 run = 0; run < BENCH_RUNS; run++) {
+    double t0 = now_ns();
+
+    for (u32 r = 0; r < reps; r++) {
+      if (run_pass(kind, rng, order, n) != 0) {
+        fprintf(stderr, "%s failed at n=%u\n", g_pass_names[kind], n);
+        return -1;
+      }
+    }
+
+    double ns = (now_ns() - t0) / ((double)reps * (double)n);
+
+    if (run == 0 || ns < best)
+      best = ns;
+  }
+  printf("shuffle %-8s n=%-8u %6.2f ns/element  %7.1f M/s\n",
+      g_pass_names[kind],
+      n,
+      best,
+      1e3 / best);
+  return 0;
+}
+
+int main(void) {
+  static struct Rng rng;
+  struct ShuffleOrder order;
+  u32 cap = g_sizes[sizeof(g_sizes) / sizeof(g_sizes[0]) - 1U];
+  u32* values = calloc(cap, sizeof(*values));
+  u32* stamps = calloc(cap, sizeof(*stamps));
+  int rc = (values && stamps) ? 0 : -1;
+
+  if (rc == 0 && (rng_init(&rng) != 0 ||
+                     rng_order_init(&order, values, stamps, cap) != 0))
+    rc = -1;
+  for (u32 i = 0; rc == 0 && i < cap; i++)
+    values[i] = i;
+  for (size_t k = 0; rc == 0 && k < sizeof(g_sizes) / sizeof(g_sizes[0]);
+       k++) {
+    for (int p = 0; rc == 0 && p < PASS_COUNT; p++)
+      rc = bench_pass((enum pass_kind)p, &rng, &order, g_sizes[k]);
+  }
+  free(values);
+  free(stamps);
+  return (rc == 0) ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: MIT
+/* Memory per item of the group/item tables and the round state, for
+ * generated decks of about 100K and 2M items, in the current layout and
+ * in the one it replaced (16-byte items, 24-byte groups and a size_t
+ * order entry per group and per prompt of the largest group, recomputed
+ * from the same counts).
+ *
+ *   bin/bench-tables
+ */
+#include "parser.h"
+#include "rng.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_CHUNK (1024U * 1024U)
+#define OLD_ITEM_BYTES 16U
+#define OLD_GROUP_BYTES 24U
+#define OLD_ORDER_BYTES 8U
+
+struct deck_shape {
+  const char* name;
+  u32 groups;
+  u32 items_per_group;
+  /* Every `extra_every`th group gets one more item (0: none). */
+  u32 extra_every;
+};
+
+static const struct deck_shape g_shapes[] = {
+    {"100K items, 40K groups", 40000U, 2U, 2U},
+    {"2M items, 20 groups", 20U, 100000U, 0U},
+};
+
+static int write_all(int fd, const char* p, size_t len) {
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (len == 0)
+      break;
+    ssize_t n = write(fd, p, len);
+
+    if (n <= 0)
+      return -1;
+    p += (size_t)n;
+    len -= (size_t)n;
+  }
+  return (len == 0) ? 0 : -1;
+}
+
+static int write_deck(int fd, const struct deck_shape* shape) {
+  static char buf[BENCH_CHUNK + MAX_LINE_LEN];
+  size_t used = 0;
+
+  for (u32 g = 0; g < shape->groups; g++) {
+    u32 items = shape->items_per_group;
+
+    if (shape->extra_every && g % shape->extra_every == 0)
+      items++;
+    used += (size_t)snprintf(
+        buf + used, sizeof(buf) - used, "[Group %u | 30]\n", g);
+    for (u32 i = 0; i < items; i++) {
+      used += (size_t)snprintf(
+          buf + used, sizeof(buf) - used, "prompt %u of %u\n", i, g);
+      if (used >= BENCH_CHUNK) {
+        if (write_all(fd, buf, used) != 0)
+          return -1;
+        used = 0;
+      }
+    }
+  }
+  return write_all(fd, buf, used);
+}
+
+/* Anonymous resident memory of this process, in KiB. */
+static u64 rss_anon_kib(void) {
+  FILE* f = fopen("/proc/self/status", "r");
+  char line[256];
+  unsigned long long kib = 0;
+
+  if (!f)
+    return 0;
+  for (int i = 0; i < 256; i++) {
+    if (!fgets(line, sizeof(line), f))
+      break;
+    if (sscanf(line, "RssAnon: %llu kB", &kib) == 1)
+      break;
+  }
+  (void)fclose(f);
+  return (u64)kib;
+}
+
+static int bench_shape(const char* path, const struct deck_shape* shape) {
+  static struct Session session;
+  struct ParseOptions opts;
+  char err[256];
+  int fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+
+  if (fd < 0 || write_deck(fd, shape) != 0 || close(fd) != 0) {
+    fprintf(stderr, "failed to write %s\n", path);
+    return -1;
+  }
+  memset(&opts, 0, sizeof(opts));
+
+  u64 rss0 = rss_anon_kib();
+
+  if (parse_session_file(path, &opts, &session, err, sizeof(err)) != 0) {
+    fprintf(stderr, "parse failed: %s\n", err);
+    return -1;
+  }
+
+  u64 rss = rss_anon_kib() - rss0;
+  u64 groups = (u64)session.group_count;
+  u64 items = (u64)session.item_count;
+  u64 prompts = 0;
+
+  for (size_t g = 0; g < session.group_count; g++) {
+    if (session.groups[g].item_count > prompts)
+      prompts = session.groups[g].item_count;
+  }
+
+  /* The runner keeps a round cursor per group; only a watched deck
+   * stores its orders.
+   */
+  u64 now = groups * sizeof(struct Group) + items * sizeof(struct Item) +
+      groups * sizeof(struct PermCursor);
+  u64 old = groups * OLD_GROUP_BYTES + items * OLD_ITEM_BYTES +
+      (groups + prompts) * OLD_ORDER_BYTES;
+
+  printf("tables %-24s %8llu items  bytes/item %6.2f -> %6.2f  "
+         "RssAnon +%llu KiB\n",
+      shape->name,
+      (unsigned long long)items,
+      (double)old / (double)items,
+      (double)now / (double)items,
+      (unsigned long long)rss);
+  return session_release(&session);
+}
+
+int main(void) {
+  const char* dir = getenv("TMPDIR");
+  char path[512];
+
+  if (!dir || dir[0] == '\0')
+    dir = "/tmp";
+  if ((size_t)snprintf(path, sizeof(path), "%s/cram-bench-XXXXXX", dir) >=
+      sizeof(path))
+    return 1;
+
+  int fd = mkstemp(path);
+
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  (void)close(fd);
+
+  int rc = 0;
+
+  for (size_t k = 0; k < sizeof(g_shapes) / sizeof(g_shapes[0]); k++) {
+    rc = bench_shape(path, &g_shapes[k]);
+    if (rc != 0)
+      break;
+  }
+  (void)unlink(path);
+  return (rc == 0) ? 0 : 1;
+}
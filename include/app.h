@@ -6,18 +6,30 @@
 
 #include "config.h"
 #include "model.h"
+#include "parser.h"
 #include "rng.h"
+#include "runner.h"
 #include "term.h"
+#include "watch.h"
 
 struct app {
+  struct ParseOptions parse_opts;
+  /* Front-code the prompt text once loaded (see pack.h). */
+  int pack_text;
   struct Session session;
   struct TermState term;
   struct Rng rng;
-  size_t group_order[MAX_GROUPS];
-  size_t item_order[MAX_ITEMS_PER_GROUP];
+  /* Round cursors, plus the shuffle orders and reload scratch of a
+   * watched deck, sized once the deck is loaded.
+   */
+  struct Arena arena;
+  struct RunOrders orders;
+  struct Watch watch;
+  struct ReloadMap reload;
 };
 
 int app_main(struct app* app, int argc, char** argv);
 int app_run_file(struct app* app, const char* path);
+int app_compile_file(struct app* app, const char* path, const char* out_path);
 
 #endif
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_ARENA_H
+#define CRAM_ARENA_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+#define ARENA_ALIGN 64U
+
+/* One anonymous mapping, sized by the caller from the input and carved
+ * up during setup; nothing is handed back until arena_release. It is
+ * reserved with MAP_NORESERVE, so only the pages written cost memory.
+ */
+struct Arena {
+  char* base;
+  size_t len;
+  size_t used;
+};
+
+/* Bytes arena_take needs for `count` elements of `size`, alignment
+ * included; 0 if that overflows.
+ */
+size_t arena_bytes(size_t count, size_t size);
+int arena_init(struct Arena* arena, size_t len);
+/* Returns zeroed, ARENA_ALIGN-aligned storage, or NULL when full. */
+void* arena_take(struct Arena* arena, size_t count, size_t size);
+int arena_release(struct Arena* arena);
+
+#endif
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_CACHE_H
+#define CRAM_CACHE_H
+
+#include "model.h"
+
+/* Parse cache: deck tables stored under $XDG_CACHE_HOME/cram (or
+ * ~/.cache/cram), one entry per deck path. Entries are keyed by the
+ * deck's real path and checked against its DeckId on use.
+ */
+
+/* Maps the entry for `path` into the session; -1 on a miss of any kind
+ * (none, stale, damaged), leaving the session untouched.
+ */
+int cache_load(struct Session* session, const char* path);
+/* Writes the session's tables as the entry for `path`. */
+int cache_store(const struct Session* session, const char* path);
+
+#endif
@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_CKSUM_H
+#define CRAM_CKSUM_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+/* POSIX cksum(1) CRC of `len` bytes, length included. */
+int cksum_bytes(u32* out, const unsigned char* buf, size_t len);
+
+/* Fast 64-bit integrity hash for binary tables; not cksum-compatible. */
+u64 cksum_fast64(u64 seed, const unsigned char* buf, size_t len);
+
+#endif
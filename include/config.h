@@ -4,17 +4,33 @@
 
 #include <stddef.h>
 
-#define MAX_GROUPS 65536U
-#define MAX_ITEMS_TOTAL 1048576U
-#define MAX_ITEMS_PER_GROUP 65536U
+/* Ceilings set by the u32 fields of the tables. Storage is not sized from
+ * these but from the deck being loaded (see arena.h).
+ */
+#define MAX_GROUPS 0x40000000U
+#define MAX_ITEMS_TOTAL 0x80000000U
+#define MAX_ITEMS_PER_GROUP MAX_ITEMS_TOTAL
+/* Prompts one generator line may expand to (see gen.h). */
+#define MAX_GENERATED_PER_GROUP 0x4000000U
 #define MAX_LINE_LEN 65536U
-#define MAX_FILE_BYTES (16U * 1024U * 1024U)
+#define MAX_DECK_BYTES (1ULL << 40)
+/* Item offsets are 32-bit and relative to their group's header. */
+#define MAX_GROUP_BYTES 0xffffffffULL
+#define STREAM_BLOCK_BYTES (256U * 1024U)
+/* Room reserved for input of unknown length (pipes, stdin). Regular files
+ * are sized from their length instead.
+ */
+#ifndef STREAM_RESERVE_BYTES
+#define STREAM_RESERVE_BYTES (256ULL * 1024ULL * 1024ULL)
+#endif
 #define MAX_PROMPTS_PER_RUN 1048576U
 #define MAX_WAIT_LOOPS 1048576U
 #define MAX_GROUP_SECONDS 86400U
 #define MAX_GROUP_MILLISECONDS ((unsigned long long)MAX_GROUP_SECONDS * 1000ULL)
 #define RNG_RETRY_LIMIT 64U
 #define MAX_WRITE_LOOPS 65536U
+#define MAX_PARSE_JOBS 64U
+#define PARSE_MIN_CHUNK_BYTES (1024U * 1024U)
 
 typedef unsigned int u32;
 typedef unsigned long long u64;
@@ -26,8 +42,14 @@ enum {
   static_assert_max_items_per_group = 1 / ((MAX_ITEMS_PER_GROUP > 0) ? 1 : 0),
   static_assert_items_per_group_le_total =
       1 / ((MAX_ITEMS_PER_GROUP <= MAX_ITEMS_TOTAL) ? 1 : 0),
+  static_assert_generated_per_group =
+      1 / ((MAX_GENERATED_PER_GROUP <= MAX_ITEMS_PER_GROUP) ? 1 : 0),
   static_assert_max_line_len = 1 / ((MAX_LINE_LEN > 0) ? 1 : 0),
-  static_assert_max_file_bytes = 1 / ((MAX_FILE_BYTES > 0) ? 1 : 0),
+  static_assert_stream_block = 1 / ((STREAM_BLOCK_BYTES > 0) ? 1 : 0),
+  static_assert_stream_reserve =
+      1 / ((STREAM_RESERVE_BYTES >= STREAM_BLOCK_BYTES) ? 1 : 0),
+  static_assert_stream_reserve_le_deck =
+      1 / ((STREAM_RESERVE_BYTES <= MAX_DECK_BYTES) ? 1 : 0),
   static_assert_max_prompts_per_run = 1 / ((MAX_PROMPTS_PER_RUN > 0) ? 1 : 0),
   static_assert_max_wait_loops = 1 / ((MAX_WAIT_LOOPS > 0) ? 1 : 0),
   static_assert_max_group_seconds = 1 / ((MAX_GROUP_SECONDS > 0) ? 1 : 0),
@@ -38,6 +60,8 @@ enum {
               0),
   static_assert_rng_retry_limit = 1 / ((RNG_RETRY_LIMIT > 0) ? 1 : 0),
   static_assert_max_write_loops = 1 / ((MAX_WRITE_LOOPS > 0) ? 1 : 0),
+  static_assert_max_parse_jobs = 1 / ((MAX_PARSE_JOBS > 1) ? 1 : 0),
+  static_assert_parse_min_chunk = 1 / ((PARSE_MIN_CHUNK_BYTES > 0) ? 1 : 0),
 };
 
 static inline int assert_ok(int cond) {
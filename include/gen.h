@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_GEN_H
+#define CRAM_GEN_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+#define GEN_MAX_VARS 4U
+#define GEN_NAME_MAX 16U
+#define GEN_VALUE_DIGITS 9U
+
+/* Generator line: `@<template>; <name> in <lo>..<hi>; ...`. Each `{name}`
+ * in the template is replaced by a value of that range; the line stands
+ * for every combination, numbered with the last range varying fastest.
+ */
+struct GenVar {
+  const char* name;
+  size_t name_len;
+  u64 lo;
+  u64 count;
+};
+
+/* Decoded form of a generator line. It points into the line, so it is
+ * only valid while the deck text is.
+ */
+struct Generator {
+  const char* tmpl;
+  size_t tmpl_len;
+  size_t var_count;
+  struct GenVar vars[GEN_MAX_VARS];
+  u64 total;
+  size_t max_len;
+};
+
+static inline int gen_is_line(const char* line, size_t len) {
+  return len > 0 && line[0] == '@';
+}
+
+/* On error returns -1 and points *why at a static message. */
+int gen_parse(
+    struct Generator* gen, const char* line, size_t len, const char** why);
+/* Renders combination `index` (< total) into buf. */
+int gen_render(const struct Generator* gen,
+    u64 index,
+    char* buf,
+    size_t cap,
+    size_t* out_len);
+
+#endif
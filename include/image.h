@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_IMAGE_H
+#define CRAM_IMAGE_H
+
+#include <stddef.h>
+
+#include "model.h"
+
+/* Compiled deck: header, group table, item table, then the deck text.
+ * Tables are stored in host layout so a mapped image is used in place.
+ */
+#define IMAGE_MAGIC "CRAMDECK"
+#define IMAGE_MAGIC_LEN 8U
+#define IMAGE_VERSION 5U
+/* Parse cache entry: same layout with the text left in the deck file. */
+#define INDEX_MAGIC "CRAMINDX"
+
+int image_detect(const void* addr, size_t len);
+int image_attach(struct Session* session, char* err_buf, size_t err_len);
+int image_write(const struct Session* session,
+    const char* path,
+    char* err_buf,
+    size_t err_len);
+int image_attach_index(struct Session* session,
+    const void* addr,
+    size_t len,
+    char* err_buf,
+    size_t err_len);
+int image_write_index(const struct Session* session,
+    const char* path,
+    char* err_buf,
+    size_t err_len);
+
+#endif
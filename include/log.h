@@ -4,18 +4,42 @@
 
 #include <stddef.h>
 
+#include "config.h"
+
 struct Session;
+struct ReloadMap;
+struct RunOrders;
+struct TermScreen;
 
 int log_open(const struct Session* session);
 int log_close(const struct Session* session);
 
 int log_input(const struct Session* session, const char* path);
+int log_parse(const struct Session* session);
+int log_ingest(const struct Session* session);
+int log_pack(const struct Session* session);
+/* Bytes per item of the tables and of the round state they need: a
+ * cursor per group, and the stored orders of a watched deck.
+ */
+int log_tables(const struct Session* session, const struct RunOrders* orders);
+int log_reload(const struct Session* session, const struct ReloadMap* map);
 
 int log_simple(const char* tag, const char* msg);
 int log_key(int key);
-int log_prompt(
-    const struct Session* session, size_t group_index, size_t item_index);
+int log_prompt(const struct Session* session,
+    size_t group_index,
+    size_t prompt,
+    const char* text,
+    size_t len,
+    u64 decode_ns);
 int log_group(const char* tag, size_t group_index);
 int log_shuffle(const char* tag, size_t group_index);
+/* Prompts advanced through without being drawn, before the one drawn. */
+int log_frames(size_t skipped);
+/* Frames drawn in a run, how many only rewrote what changed or were
+ * dropped behind a slow terminal, the write() calls and bytes they took,
+ * and how long output was stalled.
+ */
+int log_draw(const struct TermScreen* screen);
 
 #endif
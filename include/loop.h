@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_LOOP_H
+#define CRAM_LOOP_H
+
+#include <signal.h>
+#include <stddef.h>
+
+#include "config.h"
+
+/* Bytes of input taken per wakeup: all a terminal buffers in raw mode,
+ * so held keys and pastes arrive in one read.
+ */
+#define LOOP_KEY_BATCH 4096U
+
+/* The runner's single blocking point: an epoll set over the keyboard
+ * (stdin), the group timer (a timerfd), SIGINT/SIGTERM/SIGHUP/SIGWINCH
+ * (a signalfd; they are blocked while the loop is open), the deck watch,
+ * if any, and the terminal output while output is queued for it.
+ */
+struct EventLoop {
+  int epoll_fd;
+  int timer_fd;
+  int signal_fd;
+  int watch_fd;
+  /* Descriptor waited on for output, -1 if none. */
+  int output_fd;
+  sigset_t saved_mask;
+  int active;
+};
+
+/* What a wakeup brought. */
+struct LoopEvents {
+  /* Keys in the order they were typed, without terminal replies to the
+   * startup probe (see term_screen_open) that came in too late for it.
+   */
+  unsigned char keys[LOOP_KEY_BATCH];
+  size_t key_count;
+  int expired;
+  int changed;
+  int quit;
+  int resized;
+  int writable;
+};
+
+int loop_open(struct EventLoop* loop,
+    int watch_fd,
+    char* err_buf,
+    size_t err_len);
+/* Restores the signal mask; the loop can be opened again. */
+int loop_close(struct EventLoop* loop);
+/* (Re)arms the timer to expire `seconds` from now. */
+int loop_arm_timer(struct EventLoop* loop, unsigned int seconds);
+/* Waits for fd (the terminal output) to take more output, or stops
+ * waiting.
+ */
+int loop_watch_output(struct EventLoop* loop, int fd, int on);
+/* Blocks until at least one source is ready and reports all that are. */
+int loop_wait(struct EventLoop* loop, struct LoopEvents* out);
+
+#endif
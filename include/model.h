@@ -4,30 +4,134 @@
 
 #include <stddef.h>
 
+#include "arena.h"
 #include "config.h"
 
+/* Start of a prompt line, relative to its group's name_offset. The line
+ * runs to the next '\n' (less one '\r'), so its length is not stored;
+ * see session_line().
+ */
 struct Item {
   u32 offset;
-  u32 length;
 };
 
+/* Set on groups whose header ends in `| generate`: their one line is a
+ * generator (see gen.h). In other groups a line starting with `@` is an
+ * ordinary prompt.
+ */
+#define GROUP_GENERATOR 1U
+
+/* `expand` is the number of prompts a generator line stands for, 0 for
+ * plain prompt lines. `flags` holds GROUP_GENERATOR; tables are hashed
+ * and stored as raw bytes, so the layout has no padding.
+ */
 struct Group {
-  u32 name_offset;
+  u64 name_offset;
   u32 name_length;
   u32 seconds;
   u32 item_start;
   u32 item_count;
+  u32 expand;
+  u32 flags;
+};
+
+/* Identity of a mapped deck file; keys its parse cache entry. */
+struct DeckId {
+  u64 dev;
+  u64 ino;
+  u64 size;
+  u64 mtime_ns;
+  u64 ctime_ns;
+};
+
+/* Stage timings for streamed input. Stages overlap when pipelined, so
+ * read_ns + parse_ns can exceed the wall time in parse_ns of the session.
+ */
+struct IngestStats {
+  u64 read_ns;
+  u64 parse_ns;
+  u64 wait_ns;
+  u64 blocks;
+  int pipelined;
+};
+
+/* Deck text before and after front coding (see pack.h). */
+struct PackStats {
+  u64 text_bytes;
+  u64 packed_bytes;
+  u64 ns;
 };
 
 struct Session {
-  char buffer[MAX_FILE_BYTES + 1];
-  size_t buffer_len;
-  struct Group groups[MAX_GROUPS];
+  /* Deck bytes: a read-only file mapping, or the reserved range that
+   * streamed input was read into.
+   */
+  const char* text;
+  size_t text_len;
+  void* map_addr;
+  size_t map_len;
+  /* Second text reservation that a reload reads into (watch mode). */
+  void* spare_addr;
+  size_t spare_len;
+  struct DeckId deck_id;
+  int has_deck_id;
+  /* Tables: the stores below, a mapped compiled deck image, or a mapped
+   * parse cache entry (index_addr).
+   */
+  void* index_addr;
+  size_t index_len;
+  int from_cache;
+  struct Group* groups;
   size_t group_count;
-  struct Item items[MAX_ITEMS_TOTAL];
+  struct Item* items;
   size_t item_count;
+  /* Room in the tables when they live in `arena` (0 when mapped). */
+  size_t group_cap;
+  size_t item_cap;
+  /* Groups are indexed only; item_count == 0 means not loaded yet. */
+  int lazy;
+  u64 parse_ns;
+  struct IngestStats ingest;
+  /* POSIX cksum of the text when already known (compiled decks). */
+  u32 text_cksum;
+  int has_text_cksum;
+  /* Table storage, reserved once the deck size is known. */
+  struct Arena arena;
+  /* Text and tables were replaced by a front-coded copy in `arena`. */
+  int packed;
+  struct PackStats pack;
 };
 
 int session_init(struct Session* session);
+int session_release(struct Session* session);
+/* Allocates the group and item tables with room for the given counts. */
+int session_reserve(struct Session* session, size_t group_cap, size_t item_cap);
+/* Moves the tables (group_count groups, item_count items) to a new
+ * allocation with room for the given counts.
+ */
+int session_grow(struct Session* session, size_t group_cap, size_t item_cap);
+
+/* Text of line `index` (< item_count) of a loaded group. Lines of a
+ * packed session may be decoded into buf (MAX_LINE_LEN bytes); otherwise
+ * buf is unused and may be NULL.
+ */
+int session_line(const struct Session* session,
+    size_t group_index,
+    size_t index,
+    char* buf,
+    const char** out_text,
+    size_t* out_len);
+/* Prompts a loaded group shows: its lines, or its generator's expansion. */
+size_t session_prompt_count(const struct Session* session, size_t group_index);
+/* Bytes of prompt `prompt` (< session_prompt_count) of a group. Plain
+ * lines point into the deck text; generated prompts and decoded packed
+ * lines are placed in buf, which must hold MAX_LINE_LEN bytes.
+ */
+int session_prompt(const struct Session* session,
+    size_t group_index,
+    size_t prompt,
+    char* buf,
+    const char** out_text,
+    size_t* out_len);
 
 #endif
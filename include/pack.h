@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_PACK_H
+#define CRAM_PACK_H
+
+#include <stddef.h>
+
+#include "model.h"
+
+/* Front-coded deck text. Each group's name is copied as is, followed by
+ * one entry per line: <prefix><suffix length><suffix bytes>, the lengths
+ * as LEB128, where `prefix` bytes are shared with the group's previous
+ * line. Every PACK_RESTART-th line of a group shares nothing, so a line
+ * decodes from at most PACK_RESTART entries. Groups and items keep their
+ * meaning with the packed text in place of the deck text.
+ */
+#define PACK_RESTART 16U
+/* Two LEB128 lengths of at most MAX_LINE_LEN. */
+#define PACK_ENTRY_HEADER_MAX 6U
+
+/* Replaces the text and tables of a fully loaded session with a packed
+ * copy and releases the originals (mapping, cache entry, tables).
+ */
+int pack_session(struct Session* session, char* err_buf, size_t err_len);
+/* Line `index` of a group of a packed session. Lines that share no
+ * prefix are returned in place; the others are decoded into buf, which
+ * must hold MAX_LINE_LEN bytes.
+ */
+int pack_line(const struct Session* session,
+    size_t group_index,
+    size_t index,
+    char* buf,
+    const char** out_text,
+    size_t* out_len);
+
+#endif
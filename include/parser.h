@@ -4,7 +4,80 @@
 
 #include "model.h"
 
-int parse_session_file(
-    const char* path, struct Session* session, char* err_buf, size_t err_len);
+struct ParseOptions {
+  /* Worker processes for chunked parsing; 0 or 1 parses serially. */
+  unsigned int jobs;
+  /* Read in a separate process, overlapping I/O with parsing. */
+  int pipeline;
+  /* Index group headers only; see parse_group_items(). */
+  int lazy;
+  /* Use the parse cache for mapped text decks (see cache.h). */
+  int cache;
+  /* Keep a private copy of the text so it can be reloaded in place. */
+  int watch;
+};
+
+/* How a reload renumbered a table: the first `head` entries kept their
+ * index, the last `tail` old entries became the last `tail` new ones,
+ * and the rest were removed (old) or added (new).
+ */
+struct ReloadSpan {
+  size_t head;
+  size_t tail;
+  size_t old_count;
+  size_t new_count;
+};
+
+struct ReloadMap {
+  /* In: the group whose items are tracked (the one on screen). */
+  size_t group;
+  /* In: most prompts a group may have (the size of the stored orders);
+   * a reload that re-parses a larger group is rejected.
+   */
+  size_t prompt_cap;
+  /* Out: group renumbering, and the tracked group's new index and
+   * renumbering of its items (group-relative) if it survived.
+   */
+  struct ReloadSpan groups;
+  int group_kept;
+  size_t group_new;
+  struct ReloadSpan items;
+  size_t parsed_bytes;
+  u64 ns;
+  /* Scratch: the tables as they were before the reload. Sized by the
+   * caller to the session's group_cap and item_cap.
+   */
+  struct Group* saved_groups;
+  struct Item* saved_items;
+};
+
+int parse_session_file(const char* path,
+    const struct ParseOptions* opts,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len);
+
+/* Builds the item slices of a group in a lazily parsed session on first
+ * use; a no-op for loaded groups and eager sessions. Errors in the
+ * group's lines are reported here rather than at load time.
+ */
+int parse_group_items(struct Session* session,
+    size_t group_index,
+    char* err_buf,
+    size_t err_len);
+
+/* Re-reads `path` (a session loaded with `watch`) and re-parses only the
+ * groups that overlap the changed bytes. Groups keep their identity when
+ * their name survives, items when their text does. On failure the
+ * session keeps the previous deck and err_buf describes the new one.
+ */
+int parse_session_reload(struct Session* session,
+    const char* path,
+    struct ReloadMap* map,
+    char* err_buf,
+    size_t err_len);
+
+/* Stores the new index of `old` under `span`; -1 if it was removed. */
+int reload_index(const struct ReloadSpan* span, size_t old, size_t* out_new);
 
 #endif
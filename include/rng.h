@@ -11,10 +11,79 @@ struct Rng {
   u64 state;
 };
 
+/* Entries a shuffle order may need: groups or prompts of one group. */
+#define ORDER_MAX_ENTRIES                                                      \
+  (MAX_GROUPS > MAX_ITEMS_PER_GROUP ? MAX_GROUPS : MAX_ITEMS_PER_GROUP)
+
+/* A shuffle order drawn one position at a time (incremental Fisher-Yates).
+ * An entry whose stamp is not the current `stamp` holds its own index, so
+ * making the order the identity again takes O(1). `values` and `stamps`
+ * hold `cap` entries and start out zeroed.
+ */
+struct ShuffleOrder {
+  u32* values;
+  u32* stamps;
+  size_t cap;
+  u32 stamp;
+};
+
+/* A keyed bijection on [0, count): a balanced Feistel network over the
+ * fewest even number of bits that covers count, cycle-walked back into
+ * range. Entry i of a random order in O(1) time and no storage. Feistel
+ * networks on a few bits only reach a skewed subset of the orders, so up
+ * to PERM_SMALL_MAX entries the key is instead the order's rank among all
+ * count! of them (half_bits is 0).
+ */
+#define PERM_ROUNDS 8U
+#define PERM_SMALL_MAX 20U
+
+struct Permutation {
+  u64 key;
+  u32 count;
+  u32 half_bits;
+};
+
+/* A round over a permutation set aside: its key, size and the next
+ * position to draw. A zeroed cursor (count 0) holds no round.
+ */
+struct PermCursor {
+  u64 key;
+  u32 count;
+  u32 pos;
+};
+
 int rng_init(struct Rng* rng);
 u64 rng_next_u64(struct Rng* rng);
+/* Uniform in [0, upper); a division only in the rare rejection case. */
 size_t rng_range(struct Rng* rng, size_t upper);
-int rng_shuffle_groups(struct Rng* rng, size_t* values, size_t count);
-int rng_shuffle_items(struct Rng* rng, size_t* values, size_t count);
+/* Uniformly permutes values[0, count) in place (Fisher-Yates). Serial:
+ * rounds never shuffle a whole group (they use the permutations and
+ * orders below), and a million entries take a few milliseconds.
+ */
+int rng_shuffle(struct Rng* rng, u32* values, size_t count);
+
+/* Picks a fresh random order of [0, count). */
+int rng_perm_init(struct Permutation* perm, struct Rng* rng, size_t count);
+u32 rng_perm_at(const struct Permutation* perm, size_t index);
+int rng_perm_save(
+    const struct Permutation* perm, size_t pos, struct PermCursor* out);
+/* Picks the saved order again; -1 if the cursor holds no round. */
+int rng_perm_load(struct Permutation* perm, const struct PermCursor* cursor);
+
+int rng_order_init(
+    struct ShuffleOrder* order, u32* values, u32* stamps, size_t cap);
+/* Makes entry i hold i again, for every entry. */
+int rng_order_reset(struct ShuffleOrder* order);
+u32 rng_order_at(const struct ShuffleOrder* order, size_t index);
+int rng_order_put(struct ShuffleOrder* order, size_t index, u32 value);
+/* Swaps a uniformly chosen entry of [pos, count) into `pos` and returns
+ * it. Drawing positions 0, 1, ... count - 1 in turn yields a uniformly
+ * random permutation of the entries, whatever order they were in.
+ */
+int rng_order_draw(struct Rng* rng,
+    struct ShuffleOrder* order,
+    size_t pos,
+    size_t count,
+    u32* out);
 
 #endif
@@ -4,14 +4,35 @@
 
 #include <stddef.h>
 
+#include "config.h"
+#include "rng.h"
+
 struct Session;
-struct Rng;
 struct TermState;
+struct Watch;
+struct ReloadMap;
+
+/* Round state of a run (see rng.h). Each group keeps the round over its
+ * prompts in a cursor while other groups are shown, so coming back to it
+ * resumes that round. A watched deck also stores its shuffle orders: one
+ * over the groups and one over the current group's prompts once a reload
+ * has renumbered them (values are NULL otherwise). Group and prompt
+ * numbers fit in 32 bits (see config.h).
+ */
+struct RunOrders {
+  struct PermCursor* cursors;
+  size_t cursor_cap;
+  struct ShuffleOrder groups;
+  struct ShuffleOrder items;
+};
 
 int runner_run(const struct TermState* term,
     struct Session* session,
     struct Rng* rng,
-    size_t* group_order,
-    size_t* item_order);
+    struct RunOrders* orders,
+    struct Watch* watch,
+    struct ReloadMap* reload,
+    char* err_buf,
+    size_t err_len);
 
 #endif
@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_SCAN_H
+#define CRAM_SCAN_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+#define SCAN_BATCH_LINES 256U
+
+enum scan_level {
+  SCAN_SCALAR = 0,
+  SCAN_SSE2 = 1,
+  SCAN_AVX2 = 2,
+};
+
+/* One physical line. `len` excludes the '\n' and one trailing '\r';
+ * `first` is the offset of the first non-space byte, or `len` if blank.
+ */
+struct ScanLine {
+  size_t start;
+  size_t len;
+  size_t first;
+};
+
+struct Scanner {
+  const char* buf;
+  size_t len;
+  size_t pos;
+  int done;
+  /* If set, text after the last '\n' is left unread (see scan_lines). */
+  int open_end;
+  enum scan_level level;
+  /* Lines are checked as UTF-8 before they are returned: the text
+   * before `checked` is valid, and `bad` is the offset of the first
+   * invalid byte found (SIZE_MAX if none), so a line reaching past it
+   * holds it.
+   */
+  size_t checked;
+  size_t bad;
+};
+
+/* Locale-independent equivalent of isspace() in the "C" locale. */
+static inline int scan_is_space(unsigned char ch) {
+  return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+enum scan_level scan_detect(void);
+/* Caps what scan_detect() returns (benchmarks compare the paths); it
+ * never goes above what the CPU supports.
+ */
+void scan_limit(enum scan_level level);
+const char* scan_level_name(enum scan_level level);
+
+int scan_start(struct Scanner* sc, const char* buf, size_t len);
+size_t scan_lines(struct Scanner* sc, struct ScanLine* out, size_t max);
+/* Offset of the first byte of buf[0, len) that does not start or belong
+ * to a well-formed UTF-8 sequence (no overlong forms, surrogates or code
+ * points past U+10FFFF, none cut short), or `len` if the text is valid.
+ */
+size_t scan_utf8(enum scan_level level, const char* buf, size_t len);
+/* Length of the line at buf[start] as scan_lines() splits it; more than
+ * MAX_LINE_LEN if the line is longer.
+ */
+size_t scan_line_length(const char* buf, size_t len, size_t start);
+
+#endif
@@ -5,16 +5,121 @@
 #include <stddef.h>
 #include <termios.h>
 
+#include "config.h"
+
+/* A frame turns the prompt on screen into the next one, written with a
+ * single write(): either the whole screen (clear, the prompt's bytes and
+ * a newline) or, when the two prompts share a beginning, a cursor move
+ * past it, an erase of the rest and the new prompt's remaining bytes.
+ * Terminals that support synchronized output (DEC mode 2026) get each
+ * frame between its begin and end markers, so it shows at once.
+ */
+#define TERM_CLEAR_SEQ "\033[2J\033[H"
+#define TERM_CLEAR_LEN (sizeof(TERM_CLEAR_SEQ) - 1U)
+#define TERM_SYNC_BEGIN "\033[?2026h"
+#define TERM_SYNC_END "\033[?2026l"
+#define TERM_SYNC_LEN (sizeof(TERM_SYNC_BEGIN) + sizeof(TERM_SYNC_END) - 2U)
+#define TERM_FRAME_MAX (TERM_SYNC_LEN + TERM_CLEAR_LEN + MAX_LINE_LEN + 1U)
+
 struct TermState {
   struct termios original;
   int active;
 };
 
+int term_attach_tty(char* err_buf, size_t err_len);
 int term_enter_raw(struct TermState* state, char* err_buf, size_t err_len);
 int term_restore(struct TermState* state);
 int term_clear_screen(void);
 int term_hide_cursor(void);
 int term_show_cursor(void);
-int term_read_key_timeout(int timeout_ms, int* out_key);
+
+struct TermFrame {
+  char bytes[TERM_FRAME_MAX];
+  size_t len;
+  /* The prompt the frame leaves on screen. */
+  char text[MAX_LINE_LEN];
+  size_t text_len;
+  u64 base;
+  int diff;
+};
+
+/* What the frames drawn so far left on the terminal. */
+struct TermScreen {
+  /* The prompt on screen, drawn from the top left corner; valid once a
+   * frame has been drawn since the screen was opened or resized.
+   */
+  char text[MAX_LINE_LEN];
+  size_t len;
+  int valid;
+  /* The prompt is sure to be where it was drawn: no control bytes, and
+   * short enough not to have scrolled the screen.
+   */
+  int fits;
+  /* Size in cells; 0 when unknown, which disables differential frames. */
+  unsigned int cols;
+  unsigned int rows;
+  int sync;
+  /* Bumped by every draw and resize: a frame built against another
+   * serial no longer applies.
+   */
+  u64 serial;
+  /* Output never blocks: what the terminal does not take is queued. The
+   * rest of the frame being written goes out first, then the newest
+   * frame waiting for it; a waiting frame that a newer one replaces is
+   * dropped. The screen above describes the frame being written, which
+   * is what waiting frames are built against.
+   */
+  char out[TERM_FRAME_MAX];
+  size_t out_pos;
+  size_t out_len;
+  struct TermFrame next;
+  int next_ready;
+  /* Frames go out through a descriptor of their own for the terminal,
+   * opened non-blocking; stdout's open file, which the shell may share,
+   * keeps its flags. It is stdout itself when stdout is no terminal, and
+   * -1 while the screen is closed.
+   */
+  int out_fd;
+  /* Start of the current stall, 0 if output is keeping up. */
+  u64 stall_start_ns;
+  u64 frames;
+  u64 diffs;
+  u64 dropped;
+  u64 writes;
+  u64 bytes;
+  u64 stalled_ns;
+  u64 max_stall_ns;
+};
+
+/* Reads the terminal size and asks whether it supports synchronized
+ * output, waiting briefly for the answer (keys typed meanwhile are lost),
+ * then opens the terminal again for non-blocking output.
+ */
+int term_screen_open(struct TermScreen* screen);
+/* Finishes the frame being written, blocking, drops any frame waiting
+ * and closes the output descriptor.
+ */
+int term_screen_close(struct TermScreen* screen);
+/* Reads the size again and redraws the whole screen: the frame waiting
+ * for the terminal, if any, or else the prompt on screen.
+ */
+int term_screen_resize(struct TermScreen* screen);
+int term_build_frame(const struct TermScreen* screen,
+    struct TermFrame* frame,
+    const char* text,
+    size_t len);
+/* 1 if the frame was built against what is on screen now. */
+int term_frame_fresh(const struct TermScreen* screen,
+    const struct TermFrame* frame);
+/* Writes the frame, or queues it behind the one being written. */
+int term_write_frame(struct TermScreen* screen, const struct TermFrame* frame);
+/* Writes what the terminal takes of the queue; call when the output
+ * descriptor is writable.
+ */
+int term_flush(struct TermScreen* screen);
+/* 1 while frames wait for the terminal. */
+int term_output_pending(const struct TermScreen* screen);
+/* Descriptor frames are written to; -1 while the screen is closed. */
+int term_output_fd(const struct TermScreen* screen);
 
 #endif
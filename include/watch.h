@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef CRAM_WATCH_H
+#define CRAM_WATCH_H
+
+#include <stddef.h>
+
+#define WATCH_NAME_MAX 256U
+
+/* inotify watch on the directory holding a deck, so both in-place writes
+ * and editors that save by renaming a new file over the deck are seen.
+ */
+struct Watch {
+  int fd;
+  const char* path;
+  char name[WATCH_NAME_MAX];
+};
+
+int watch_open(
+    struct Watch* watch, const char* path, char* err_buf, size_t err_len);
+/* Reads all pending events; sets *changed if any concerned the deck. */
+int watch_drain(struct Watch* watch, int* changed);
+int watch_close(struct Watch* watch);
+
+#endif
@@ -1,6 +1,10 @@
 // SPDX-License-Identifier: MIT
 #include "app.h"
+#include "cache.h"
+#include "cksum.h"
+#include "image.h"
 #include "log.h"
+#include "pack.h"
 #include "parser.h"
 #include "runner.h"
 #include "term.h"
@@ -12,11 +16,37 @@ static int print_usage(const char* prog) {
   if (!prog)
     return -1;
 
-  int rc = fprintf(stdout, "Usage: %s <session-file>\n", prog);
+  int rc = fprintf(stdout,
+      "Usage: %s [-j jobs] [-p] [-l] [-n] [-w] [-z] <session-file>\n",
+      prog);
 
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "       %s compile <deck> -o <out.cramb>\n", prog);
   if (rc < 0)
     return -1;
   rc = fprintf(stdout, "       %s -h\n\n", prog);
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "  -j jobs  parse large files with this many workers\n");
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "  -p       read in a separate process while parsing\n");
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "  -l       load groups when first used\n");
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "  -n       do not use the parse cache\n");
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "  -w       reload the deck when the file changes\n");
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "  -z       keep prompt text front-coded in memory\n");
+  if (rc < 0)
+    return -1;
+  rc = fprintf(stdout, "  Pass - as <session-file> to read stdin\n");
   if (rc < 0)
     return -1;
   rc = fprintf(stdout, "Keys: Enter/Space/alnum = next, Ctrl+C = quit\n");
@@ -34,7 +64,8 @@ static int setup_session(struct app* app, const char* path) {
     return -1;
 
   char err_buf[256];
-  int rc = parse_session_file(path, &app->session, err_buf, sizeof(err_buf));
+  int rc = parse_session_file(
+      path, &app->parse_opts, &app->session, err_buf, sizeof(err_buf));
 
   if (rc != 0) {
     rc = fprintf(stderr, "Error: %s\n", err_buf);
@@ -42,9 +73,97 @@ static int setup_session(struct app* app, const char* path) {
       return -1;
     return -1;
   }
+  if (strcmp(path, "-") == 0)
+    rc = term_attach_tty(err_buf, sizeof(err_buf));
+  if (rc != 0) {
+    rc = fprintf(stderr, "Error: %s\n", err_buf);
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+  return 0;
+}
+
+static int parse_jobs(const char* arg, unsigned int* out_jobs) {
+  if (!validate_ptr(arg))
+    return -1;
+  if (!validate_ptr(out_jobs))
+    return -1;
+
+  size_t len = strlen(arg);
+  unsigned int jobs = 0;
+
+  if (len < 1 || len > 3)
+    return -1;
+  for (size_t i = 0; i < len; i++) {
+    char ch = arg[i];
+
+    if (ch < '0' || ch > '9')
+      return -1;
+    jobs = jobs * 10U + (unsigned int)(ch - '0');
+  }
+  if (jobs < 1 || jobs > MAX_PARSE_JOBS)
+    return -1;
+  *out_jobs = jobs;
   return 0;
 }
 
+/* Returns the index of the session-file argument, or -1.
+ * With `out_index`, also accepts "-o <path>" and reports its index.
+ */
+static int parse_args(
+    struct app* app, int argc, char** argv, int first, int* out_index) {
+  int path_index = -1;
+
+  app->parse_opts.jobs = 1;
+  app->parse_opts.pipeline = 0;
+  app->parse_opts.lazy = 0;
+  app->parse_opts.cache = 1;
+  app->parse_opts.watch = 0;
+  app->pack_text = 0;
+  for (int i = first; i < argc; i++) {
+    if (out_index && strcmp(argv[i], "-o") == 0) {
+      if (i + 1 >= argc || *out_index >= 0)
+        return -1;
+      *out_index = i + 1;
+      i++;
+      continue;
+    }
+    if (strcmp(argv[i], "-j") == 0) {
+      if (i + 1 >= argc)
+        return -1;
+      if (parse_jobs(argv[i + 1], &app->parse_opts.jobs) != 0)
+        return -1;
+      i++;
+      continue;
+    }
+    if (strcmp(argv[i], "-p") == 0) {
+      app->parse_opts.pipeline = 1;
+      continue;
+    }
+    if (strcmp(argv[i], "-l") == 0) {
+      app->parse_opts.lazy = 1;
+      continue;
+    }
+    if (strcmp(argv[i], "-n") == 0) {
+      app->parse_opts.cache = 0;
+      continue;
+    }
+    if (strcmp(argv[i], "-w") == 0) {
+      app->parse_opts.watch = 1;
+      continue;
+    }
+    if (strcmp(argv[i], "-z") == 0) {
+      app->pack_text = 1;
+      continue;
+    }
+    if (path_index >= 0)
+      return -1;
+    path_index = i;
+  }
+  return path_index;
+}
+
 int app_main(struct app* app, int argc, char** argv) {
   if (!validate_ptr(app))
     return 1;
@@ -59,7 +178,24 @@ int app_main(struct app* app, int argc, char** argv) {
 
     return (rc == 0) ? 0 : 1;
   }
-  if (argc != 2) {
+
+  if (argc >= 2 && strcmp(argv[1], "compile") == 0) {
+    int out_index = -1;
+    int path_index = parse_args(app, argc, argv, 2, &out_index);
+
+    if (path_index >= 0 && out_index >= 0) {
+      int rc = app_compile_file(app, argv[path_index], argv[out_index]);
+
+      return (rc == 0) ? 0 : 1;
+    }
+    int rc = print_usage(argv[0]);
+
+    return (rc == 0) ? 1 : 2;
+  }
+
+  int path_index = parse_args(app, argc, argv, 1, NULL);
+
+  if (path_index < 0) {
     int rc = print_usage(argv[0]);
 
     /* Usage error.
@@ -68,7 +204,7 @@ int app_main(struct app* app, int argc, char** argv) {
     return (rc == 0) ? 1 : 2;
   }
 
-  return (app_run_file(app, argv[1]) == 0) ? 0 : 1;
+  return (app_run_file(app, argv[path_index]) == 0) ? 0 : 1;
 }
 
 static int run_with_terminal(struct app* app) {
@@ -86,12 +222,18 @@ static int run_with_terminal(struct app* app) {
   int hide_rc = term_hide_cursor();
   int loop_rc = -1;
 
+  err_buf[0] = '\0';
   if (hide_rc == 0) {
+    int watching = app->watch.fd >= 0;
+
     loop_rc = runner_run(&app->term,
         &app->session,
         &app->rng,
-        app->group_order,
-        app->item_order);
+        &app->orders,
+        watching ? &app->watch : NULL,
+        watching ? &app->reload : NULL,
+        err_buf,
+        sizeof(err_buf));
   }
 
   int restore_rc = term_restore(&app->term);
@@ -107,23 +249,193 @@ static int run_with_terminal(struct app* app) {
 
   if (hide_rc != 0)
     return -1;
+  /* Deck errors found while running (lazily loaded groups). */
+  if (loop_rc != 0 && err_buf[0] != '\0') {
+    rc = fprintf(stderr, "Error: %s\n", err_buf);
+    if (rc < 0)
+      return -1;
+  }
   return loop_rc;
 }
 
+/* Stores freshly parsed tables in the parse cache. The entry carries the
+ * deck cksum, so it is computed here once and reused by log_input.
+ */
+static int update_cache(struct app* app, const char* path) {
+  struct Session* session = &app->session;
+
+  if (!app->parse_opts.cache || !session->has_deck_id)
+    return 0;
+  if (session->from_cache)
+    return log_simple("cache", "hit");
+  if (session->lazy)
+    return log_simple("cache", "miss");
+  if (!session->has_text_cksum) {
+    int rc = cksum_bytes(&session->text_cksum,
+        (const unsigned char*)session->text,
+        session->text_len);
+
+    if (rc != 0)
+      return -1;
+    session->has_text_cksum = 1;
+  }
+
+  int rc = cache_store(session, path);
+
+  return log_simple("cache", (rc == 0) ? "stored" : "store failed");
+}
+
+/* Every group gets a cursor for its round over the prompts. Shuffle
+ * orders are computed as they are drawn (see rng.h), except for a
+ * watched deck: a reload renumbers groups and prompts, so its orders are
+ * stored. Reloads may bring more and larger groups, so those get room
+ * for what the tables can hold, plus the largest generator's prompts if
+ * the deck has one; a reload past that is rejected (see ReloadMap).
+ */
+static int reserve_orders(struct app* app) {
+  struct Session* session = &app->session;
+
+  if (app->watch.fd < 0) {
+    size_t groups = session->group_count;
+
+    if (arena_init(&app->arena,
+            arena_bytes(groups, sizeof(struct PermCursor))) != 0)
+      return -1;
+    app->orders.cursors =
+        arena_take(&app->arena, groups, sizeof(struct PermCursor));
+    app->orders.cursor_cap = groups;
+    if (!assert_ptr(app->orders.cursors))
+      return -1;
+    return 0;
+  }
+
+  size_t groups = session->group_cap;
+  size_t generated = 0;
+
+  for (size_t g = 0; g < MAX_GROUPS; g++) {
+    if (g >= session->group_count)
+      break;
+    if ((session->groups[g].flags & GROUP_GENERATOR) &&
+        session->groups[g].expand > generated)
+      generated = session->groups[g].expand;
+  }
+
+  size_t prompts = session->item_cap + generated;
+
+  if (prompts > ORDER_MAX_ENTRIES)
+    prompts = ORDER_MAX_ENTRIES;
+  app->reload.prompt_cap = prompts;
+
+  /* Each order entry is a value and its stamp (see rng.h). */
+  size_t bytes = arena_bytes(groups, sizeof(struct PermCursor)) +
+      2U * arena_bytes(groups, sizeof(u32)) +
+      2U * arena_bytes(prompts, sizeof(u32)) +
+      arena_bytes(session->group_cap, sizeof(struct Group)) +
+      arena_bytes(session->item_cap, sizeof(struct Item));
+
+  if (arena_init(&app->arena, bytes) != 0)
+    return -1;
+  app->orders.cursors =
+      arena_take(&app->arena, groups, sizeof(struct PermCursor));
+  app->orders.cursor_cap = groups;
+
+  u32* group_values = arena_take(&app->arena, groups, sizeof(u32));
+  u32* group_stamps = arena_take(&app->arena, groups, sizeof(u32));
+  u32* item_values = arena_take(&app->arena, prompts, sizeof(u32));
+  u32* item_stamps = arena_take(&app->arena, prompts, sizeof(u32));
+
+  app->reload.saved_groups =
+      arena_take(&app->arena, session->group_cap, sizeof(struct Group));
+  app->reload.saved_items =
+      arena_take(&app->arena, session->item_cap, sizeof(struct Item));
+  if (!assert_ptr(app->orders.cursors))
+    return -1;
+  if (!assert_ptr(app->reload.saved_groups))
+    return -1;
+  if (!assert_ptr(app->reload.saved_items))
+    return -1;
+  if (rng_order_init(
+          &app->orders.groups, group_values, group_stamps, groups) != 0)
+    return -1;
+  return rng_order_init(
+      &app->orders.items, item_values, item_stamps, prompts);
+}
+
+/* Lazy and watched decks keep parsing the text, so they stay unpacked. */
+static int pack_text(struct app* app) {
+  struct Session* session = &app->session;
+
+  if (!app->pack_text || session->lazy || app->watch.fd >= 0)
+    return 0;
+
+  char err_buf[256];
+  int rc = pack_session(session, err_buf, sizeof(err_buf));
+
+  if (rc != 0) {
+    rc = fprintf(stderr, "Error: %s\n", err_buf);
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+  return log_pack(session);
+}
+
 int app_run_file(struct app* app, const char* path) {
   if (!validate_ptr(app))
     return -1;
   if (!validate_ptr(path))
     return -1;
 
+  app->watch.fd = -1;
+  if (app->parse_opts.watch && strcmp(path, "-") == 0) {
+    int rc = fprintf(stderr, "Error: stdin cannot be watched\n");
+
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+
   int rc = setup_session(app, path);
 
   if (rc != 0)
     return -1;
+  if (app->parse_opts.watch) {
+    char err_buf[256];
+
+    rc = watch_open(&app->watch, path, err_buf, sizeof(err_buf));
+    if (rc != 0) {
+      rc = fprintf(stderr, "Error: %s\n", err_buf);
+      if (rc < 0)
+        return -1;
+      return -1;
+    }
+  }
+  rc = reserve_orders(app);
+  if (rc != 0) {
+    rc = fprintf(stderr, "Error: failed to reserve memory\n");
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
   rc = log_open(&app->session);
+  if (rc != 0)
+    return -1;
+  rc = update_cache(app, path);
   if (rc != 0)
     return -1;
   rc = log_input(&app->session, path);
+  if (rc != 0)
+    return -1;
+  rc = log_parse(&app->session);
+  if (rc != 0)
+    return -1;
+  rc = log_ingest(&app->session);
+  if (rc != 0)
+    return -1;
+  rc = pack_text(app);
+  if (rc != 0)
+    return -1;
+  rc = log_tables(&app->session, &app->orders);
   if (rc != 0)
     return -1;
   rc = rng_init(&app->rng);
@@ -131,10 +443,45 @@ int app_run_file(struct app* app, const char* path) {
     return -1;
 
   rc = run_with_terminal(app);
+  if (app->watch.fd >= 0 && watch_close(&app->watch) != 0)
+    return -1;
   if (rc != 0)
     return -1;
   rc = log_close(&app->session);
+  if (rc != 0)
+    return -1;
+  rc = session_release(&app->session);
+  if (rc != 0)
+    return -1;
+  rc = arena_release(&app->arena);
   if (rc != 0)
     return -1;
   return 0;
 }
+
+int app_compile_file(struct app* app, const char* path, const char* out_path) {
+  if (!validate_ptr(app))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+  if (!validate_ptr(out_path))
+    return -1;
+
+  char err_buf[256];
+
+  /* Images hold complete tables. */
+  app->parse_opts.lazy = 0;
+
+  int rc = parse_session_file(
+      path, &app->parse_opts, &app->session, err_buf, sizeof(err_buf));
+
+  if (rc == 0)
+    rc = image_write(&app->session, out_path, err_buf, sizeof(err_buf));
+  if (rc != 0) {
+    rc = fprintf(stderr, "Error: %s\n", err_buf);
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+  return session_release(&app->session);
+}
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: MIT
+#include "arena.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+size_t arena_bytes(size_t count, size_t size) {
+  if (size > 0 && count > (SIZE_MAX - ARENA_ALIGN) / size)
+    return 0;
+  return count * size + ARENA_ALIGN;
+}
+
+int arena_init(struct Arena* arena, size_t len) {
+  if (!validate_ptr(arena))
+    return -1;
+  if (!validate_ok(len > 0))
+    return -1;
+
+  void* addr = mmap(NULL,
+      len,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+      -1,
+      0);
+
+  if (addr == MAP_FAILED)
+    return -1;
+  arena->base = (char*)addr;
+  arena->len = len;
+  arena->used = 0;
+  return 0;
+}
+
+void* arena_take(struct Arena* arena, size_t count, size_t size) {
+  if (!validate_ptr(arena))
+    return NULL;
+  if (!validate_ptr(arena->base))
+    return NULL;
+
+  size_t bytes = arena_bytes(count, size);
+  /* The mapping is page aligned, so aligning offsets aligns addresses. */
+  size_t mask = (size_t)ARENA_ALIGN - 1U;
+  size_t start = (arena->used + mask) & ~mask;
+
+  if (bytes == 0 || start > arena->len)
+    return NULL;
+  bytes -= ARENA_ALIGN;
+  if (arena->len - start < bytes)
+    return NULL;
+  arena->used = start + bytes;
+  return arena->base + start;
+}
+
+int arena_release(struct Arena* arena) {
+  if (!validate_ptr(arena))
+    return -1;
+  if (!arena->base)
+    return 0;
+
+  int rc = munmap(arena->base, arena->len);
+
+  arena->base = NULL;
+  arena->len = 0;
+  arena->used = 0;
+  return (rc == 0) ? 0 : -1;
+}
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: MIT
+#include "cache.h"
+#include "cksum.h"
+#include "image.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_PATH_MAX 512U
+
+static int make_dir(const char* path) {
+  if (mkdir(path, 0700) == 0 || errno == EEXIST)
+    return 0;
+  return -1;
+}
+
+/* Builds "<base>/cram/<key>.idx"; with `create`, also the directories. */
+static int entry_path(
+    const char* deck_path, char* out, size_t out_len, int create) {
+  char real[PATH_MAX];
+
+  if (!realpath(deck_path, real))
+    return -1;
+
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  char base[CACHE_PATH_MAX];
+  int rc = 0;
+
+  /* XDG paths must be absolute; relative values are ignored. */
+  if (xdg && xdg[0] == '/')
+    rc = snprintf(base, sizeof(base), "%s", xdg);
+  else if (home && home[0] == '/')
+    rc = snprintf(base, sizeof(base), "%s/.cache", home);
+  else
+    return -1;
+  if (rc < 0 || (size_t)rc >= sizeof(base))
+    return -1;
+
+  char dir[CACHE_PATH_MAX];
+
+  rc = snprintf(dir, sizeof(dir), "%s/cram", base);
+  if (rc < 0 || (size_t)rc >= sizeof(dir))
+    return -1;
+  if (create && (make_dir(base) != 0 || make_dir(dir) != 0))
+    return -1;
+
+  u64 key = cksum_fast64(0, (const unsigned char*)real, strlen(real));
+
+  rc = snprintf(out, out_len, "%s/%016llx.idx", dir, (unsigned long long)key);
+  if (rc < 0 || (size_t)rc >= out_len)
+    return -1;
+  return 0;
+}
+
+int cache_load(struct Session* session, const char* path) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+  if (!session->has_deck_id)
+    return -1;
+
+  char entry[CACHE_PATH_MAX];
+
+  if (entry_path(path, entry, sizeof(entry), 0) != 0)
+    return -1;
+
+  int fd = open(entry, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  void* addr = MAP_FAILED;
+
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (close(fd) != 0 && addr != MAP_FAILED) {
+    (void)munmap(addr, (size_t)st.st_size);
+    return -1;
+  }
+  if (addr == MAP_FAILED)
+    return -1;
+
+  char err_buf[128];
+
+  if (image_attach_index(
+          session, addr, (size_t)st.st_size, err_buf, sizeof(err_buf)) != 0) {
+    (void)munmap(addr, (size_t)st.st_size);
+    return -1;
+  }
+  session->index_addr = addr;
+  session->index_len = (size_t)st.st_size;
+  session->from_cache = 1;
+  return 0;
+}
+
+int cache_store(const struct Session* session, const char* path) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+
+  char entry[CACHE_PATH_MAX];
+
+  if (entry_path(path, entry, sizeof(entry), 1) != 0)
+    return -1;
+
+  char err_buf[128];
+
+  return image_write_index(session, entry, err_buf, sizeof(err_buf));
+}
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: MIT
+#include "cksum.h"
+
+#include <string.h>
+
+static u32 cksum_update(u32 crc, unsigned char b) {
+  crc ^= (u32)b << 24;
+  for (int i = 0; i < 8; i++) {
+    if (crc & 0x80000000U)
+      crc = (crc << 1) ^ 0x04C11DB7U;
+    else
+      crc <<= 1;
+  }
+  return crc;
+}
+
+int cksum_bytes(u32* out, const unsigned char* buf, size_t len) {
+  if (!validate_ptr(out))
+    return -1;
+  if (!validate_ptr(buf))
+    return -1;
+  if (!assert_ok((u64)len <= MAX_DECK_BYTES))
+    return -1;
+
+  u32 crc = 0;
+
+  for (u64 i = 0; i < MAX_DECK_BYTES; i++) {
+    if (i >= (u64)len)
+      break;
+    crc = cksum_update(crc, buf[i]);
+  }
+
+  size_t n = len;
+
+  for (size_t i = 0; i < sizeof(size_t); i++) {
+    if (n == 0)
+      break;
+    crc = cksum_update(crc, (unsigned char)(n & 0xFF));
+    n >>= 8;
+  }
+  *out = ~crc;
+  return 0;
+}
+
+static u64 fast_mix(u64 h, u64 w) {
+  h ^= w * 0x9e3779b97f4a7c15ULL;
+  h = (h << 31) | (h >> 33);
+  return h * 0xc2b2ae3d27d4eb4fULL;
+}
+
+u64 cksum_fast64(u64 seed, const unsigned char* buf, size_t len) {
+  if (!validate_ptr(buf))
+    return 0;
+  if (!assert_ok((u64)len <= MAX_DECK_BYTES))
+    return 0;
+
+  u64 h = seed ^ ((u64)len * 0xff51afd7ed558ccdULL);
+  size_t words = len / 8U;
+
+  for (u64 i = 0; i < MAX_DECK_BYTES / 8U; i++) {
+    if (i >= (u64)words)
+      break;
+    u64 w = 0;
+
+    memcpy(&w, buf + i * 8U, sizeof(w));
+    h = fast_mix(h, w);
+  }
+
+  u64 tail = 0;
+
+  for (size_t i = words * 8U; i < len; i++)
+    tail = (tail << 8) | buf[i];
+  h = fast_mix(h, tail);
+  h ^= h >> 29;
+  return h;
+}
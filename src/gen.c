@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: MIT
+#include "gen.h"
+#include "scan.h"
+
+#include <string.h>
+
+static size_t skip_space(const char* s, size_t len, size_t i) {
+  for (size_t k = 0; k < MAX_LINE_LEN; k++) {
+    if (i >= len || !scan_is_space((unsigned char)s[i]))
+      break;
+    i++;
+  }
+  return i;
+}
+
+static int is_name_char(unsigned char ch, int first) {
+  if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_')
+    return 1;
+  return !first && ch >= '0' && ch <= '9';
+}
+
+/* Length of the name starting at s[i], or 0. */
+static size_t name_length(const char* s, size_t len, size_t i) {
+  size_t n = 0;
+
+  for (size_t k = 0; k <= GEN_NAME_MAX; k++) {
+    if (i + n >= len || !is_name_char((unsigned char)s[i + n], n == 0))
+      break;
+    n++;
+  }
+  return (n > GEN_NAME_MAX) ? 0 : n;
+}
+
+static size_t find_var(
+    const struct Generator* gen, const char* name, size_t name_len) {
+  for (size_t v = 0; v < GEN_MAX_VARS; v++) {
+    if (v >= gen->var_count)
+      break;
+    const struct GenVar* var = &gen->vars[v];
+
+    if (var->name_len == name_len && memcmp(var->name, name, name_len) == 0)
+      return v;
+  }
+  return GEN_MAX_VARS;
+}
+
+static int parse_value(const char* s, size_t len, size_t* i, u64* out) {
+  u64 value = 0;
+  size_t digits = 0;
+
+  for (size_t k = 0; k < GEN_VALUE_DIGITS + 1U; k++) {
+    if (*i >= len || s[*i] < '0' || s[*i] > '9')
+      break;
+    value = value * 10U + (u64)(s[*i] - '0');
+    digits++;
+    (*i)++;
+  }
+  if (digits == 0 || digits > GEN_VALUE_DIGITS)
+    return -1;
+  *out = value;
+  return 0;
+}
+
+static size_t value_digits(u64 value) {
+  size_t n = 1;
+
+  for (size_t k = 0; k < GEN_VALUE_DIGITS; k++) {
+    if (value < 10U)
+      break;
+    value /= 10U;
+    n++;
+  }
+  return n;
+}
+
+/* `<name> in <lo>..<hi>` in s[0, len), surrounding space allowed. */
+static int parse_range_decl(
+    struct Generator* gen, const char* s, size_t len, const char** why) {
+  size_t i = skip_space(s, len, 0);
+  size_t name_len = name_length(s, len, i);
+
+  *why = "malformed range";
+  if (name_len == 0)
+    return -1;
+
+  const char* name = s + i;
+
+  i = skip_space(s, len, i + name_len);
+  if (i + 2 > len || s[i] != 'i' || s[i + 1] != 'n')
+    return -1;
+  i += 2;
+  if (i >= len || !scan_is_space((unsigned char)s[i]))
+    return -1;
+  i = skip_space(s, len, i);
+
+  u64 lo = 0;
+  u64 hi = 0;
+
+  if (parse_value(s, len, &i, &lo) != 0)
+    return -1;
+  if (i + 2 > len || s[i] != '.' || s[i + 1] != '.')
+    return -1;
+  i += 2;
+  if (parse_value(s, len, &i, &hi) != 0)
+    return -1;
+  if (skip_space(s, len, i) != len)
+    return -1;
+  if (hi < lo) {
+    *why = "empty range";
+    return -1;
+  }
+  if (find_var(gen, name, name_len) < GEN_MAX_VARS) {
+    *why = "duplicate range name";
+    return -1;
+  }
+  if (gen->var_count >= GEN_MAX_VARS) {
+    *why = "too many ranges";
+    return -1;
+  }
+
+  struct GenVar* var = &gen->vars[gen->var_count];
+
+  var->name = name;
+  var->name_len = name_len;
+  var->lo = lo;
+  var->count = hi - lo + 1U;
+  gen->var_count++;
+  return 0;
+}
+
+/* Resolves every `{name}` and works out the longest rendering. */
+static int check_template(struct Generator* gen, const char** why) {
+  const char* t = gen->tmpl;
+  size_t len = gen->tmpl_len;
+  size_t max_len = len;
+  int used[GEN_MAX_VARS] = { 0 };
+
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (i >= len)
+      break;
+    if (t[i] == '}') {
+      *why = "unmatched '}' in template";
+      return -1;
+    }
+    if (t[i] != '{')
+      continue;
+
+    size_t name_len = name_length(t, len, i + 1);
+    size_t close = i + name_len + 1;
+    size_t v = find_var(gen, t + i + 1, name_len);
+
+    if (name_len == 0 || close >= len || t[close] != '}') {
+      *why = "malformed placeholder";
+      return -1;
+    }
+    if (v >= GEN_MAX_VARS) {
+      *why = "placeholder has no range";
+      return -1;
+    }
+
+    const struct GenVar* var = &gen->vars[v];
+
+    used[v] = 1;
+    max_len -= name_len + 2U;
+    max_len += value_digits(var->lo + var->count - 1U);
+    i = close;
+  }
+  for (size_t v = 0; v < GEN_MAX_VARS; v++) {
+    if (v >= gen->var_count)
+      break;
+    if (!used[v]) {
+      *why = "range not used in template";
+      return -1;
+    }
+  }
+  if (max_len == 0 || max_len > MAX_LINE_LEN) {
+    *why = "generated prompt too long";
+    return -1;
+  }
+  gen->max_len = max_len;
+  return 0;
+}
+
+int gen_parse(
+    struct Generator* gen, const char* line, size_t len, const char** why) {
+  if (!validate_ptr(gen))
+    return -1;
+  if (!validate_ptr(line))
+    return -1;
+  if (!validate_ptr(why))
+    return -1;
+  if (!validate_ok(len <= MAX_LINE_LEN))
+    return -1;
+
+  *why = "malformed generator";
+  if (!gen_is_line(line, len))
+    return -1;
+
+  const char* semi = memchr(line, ';', len);
+
+  if (!semi) {
+    *why = "generator has no ranges";
+    return -1;
+  }
+
+  size_t tmpl_end = (size_t)(semi - line);
+  size_t tmpl_start = skip_space(line, tmpl_end, 1);
+
+  for (size_t k = 0; k < MAX_LINE_LEN; k++) {
+    if (tmpl_end <= tmpl_start ||
+        !scan_is_space((unsigned char)line[tmpl_end - 1]))
+      break;
+    tmpl_end--;
+  }
+  if (tmpl_start >= tmpl_end) {
+    *why = "generator has an empty template";
+    return -1;
+  }
+  gen->tmpl = line + tmpl_start;
+  gen->tmpl_len = tmpl_end - tmpl_start;
+  gen->var_count = 0;
+  gen->total = 1;
+
+  size_t pos = (size_t)(semi - line) + 1U;
+
+  for (size_t k = 0; k <= GEN_MAX_VARS; k++) {
+    const char* next = memchr(line + pos, ';', len - pos);
+    size_t end = next ? (size_t)(next - line) : len;
+
+    if (parse_range_decl(gen, line + pos, end - pos, why) != 0)
+      return -1;
+
+    const struct GenVar* var = &gen->vars[gen->var_count - 1U];
+
+    if (var->count > MAX_GENERATED_PER_GROUP ||
+        gen->total * var->count > MAX_GENERATED_PER_GROUP) {
+      *why = "generator has too many combinations";
+      return -1;
+    }
+    gen->total *= var->count;
+    if (!next)
+      break;
+    pos = end + 1U;
+  }
+  return check_template(gen, why);
+}
+
+static size_t put_value(char* out, u64 value) {
+  char tmp[GEN_VALUE_DIGITS + 1U];
+  size_t n = 0;
+
+  for (size_t k = 0; k <= GEN_VALUE_DIGITS; k++) {
+    tmp[n++] = (char)('0' + (int)(value % 10U));
+    value /= 10U;
+    if (value == 0)
+      break;
+  }
+  for (size_t k = 0; k < n; k++)
+    out[k] = tmp[n - 1U - k];
+  return n;
+}
+
+int gen_render(const struct Generator* gen,
+    u64 index,
+    char* buf,
+    size_t cap,
+    size_t* out_len) {
+  if (!validate_ptr(gen))
+    return -1;
+  if (!validate_ptr(buf))
+    return -1;
+  if (!validate_ptr(out_len))
+    return -1;
+  if (!assert_ok(index < gen->total))
+    return -1;
+  if (!assert_ok(gen->max_len <= cap))
+    return -1;
+
+  u64 values[GEN_MAX_VARS];
+
+  for (size_t k = 0; k < GEN_MAX_VARS; k++) {
+    if (k >= gen->var_count)
+      break;
+    size_t v = gen->var_count - 1U - k;
+    const struct GenVar* var = &gen->vars[v];
+
+    values[v] = var->lo + index % var->count;
+    index /= var->count;
+  }
+
+  const char* t = gen->tmpl;
+  size_t len = gen->tmpl_len;
+  size_t n = 0;
+  size_t i = 0;
+
+  for (size_t k = 0; k < MAX_LINE_LEN; k++) {
+    const char* open = memchr(t + i, '{', len - i);
+    size_t lit = open ? (size_t)(open - (t + i)) : len - i;
+
+    memcpy(buf + n, t + i, lit);
+    n += lit;
+    i += lit;
+    if (!open)
+      break;
+
+    size_t name_len = name_length(t, len, i + 1U);
+    size_t v = find_var(gen, t + i + 1U, name_len);
+
+    if (!assert_ok(v < gen->var_count))
+      return -1;
+    n += put_value(buf + n, values[v]);
+    i += name_len + 2U;
+  }
+  *out_len = n;
+  return 0;
+}
@@ -0,0 +1,414 @@
+// SPDX-License-Identifier: MIT
+#include "image.h"
+#include "cksum.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IMAGE_BYTE_ORDER 0x01020304U
+#define IMAGE_PATH_MAX 512U
+
+struct image_header {
+  char magic[IMAGE_MAGIC_LEN];
+  u32 version;
+  u32 byte_order;
+  u32 header_size;
+  u32 group_size;
+  u32 item_size;
+  u32 text_cksum;
+  u64 group_count;
+  u64 item_count;
+  u64 group_offset;
+  u64 item_offset;
+  u64 text_offset;
+  u64 text_len;
+  /* cksum_fast64 over this header (with this field zero) and tables. */
+  u64 tables_hash;
+};
+
+/* Parse cache entry: the deck's tables, tied to the file they came from.
+ */
+struct index_header {
+  struct image_header image;
+  struct DeckId id;
+};
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ptr(msg))
+    return -1;
+
+  int rc = snprintf(err_buf, err_len, "%s", msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static u64 tables_hash(const struct image_header* hdr,
+    const struct Group* groups,
+    const struct Item* items) {
+  struct image_header tmp = *hdr;
+
+  tmp.tables_hash = 0;
+
+  u64 h = cksum_fast64(0, (const unsigned char*)&tmp, sizeof(tmp));
+
+  h = cksum_fast64(h,
+      (const unsigned char*)groups,
+      (size_t)hdr->group_count * sizeof(struct Group));
+  h = cksum_fast64(h,
+      (const unsigned char*)items,
+      (size_t)hdr->item_count * sizeof(struct Item));
+  return h;
+}
+
+int image_detect(const void* addr, size_t len) {
+  if (!addr || len < sizeof(struct image_header))
+    return 0;
+  return memcmp(addr, IMAGE_MAGIC, IMAGE_MAGIC_LEN) == 0;
+}
+
+/* Decks carry their text after the tables; an index leaves it in the deck
+ * file (text_offset 0) and ends after the item table.
+ */
+static int check_header(const struct image_header* hdr,
+    size_t header_size,
+    size_t file_len,
+    int external_text) {
+  if (hdr->version != IMAGE_VERSION)
+    return -1;
+  if (hdr->byte_order != IMAGE_BYTE_ORDER)
+    return -1;
+  if (hdr->header_size != header_size)
+    return -1;
+  if (hdr->group_size != sizeof(struct Group))
+    return -1;
+  if (hdr->item_size != sizeof(struct Item))
+    return -1;
+  if (hdr->group_count < 1 || hdr->group_count > MAX_GROUPS)
+    return -1;
+  if (hdr->item_count < 1 || hdr->item_count > MAX_ITEMS_TOTAL)
+    return -1;
+  if (hdr->text_len > MAX_DECK_BYTES)
+    return -1;
+
+  u64 item_offset =
+      hdr->group_offset + hdr->group_count * (u64)sizeof(struct Group);
+  u64 items_end =
+      hdr->item_offset + hdr->item_count * (u64)sizeof(struct Item);
+
+  if (hdr->group_offset != header_size)
+    return -1;
+  if (hdr->item_offset != item_offset)
+    return -1;
+  if (external_text)
+    return (hdr->text_offset == 0 && items_end == (u64)file_len) ? 0 : -1;
+  if (hdr->text_offset != items_end)
+    return -1;
+  if (hdr->text_offset + hdr->text_len != (u64)file_len)
+    return -1;
+  return 0;
+}
+
+/* Groups must own consecutive item ranges covering the table, so every
+ * item is checked once. Item line lengths depend on the text and are
+ * checked when the line is used (see session_line).
+ */
+static int check_tables(const struct image_header* hdr,
+    const struct Group* groups,
+    const struct Item* items) {
+  u64 text_len = hdr->text_len;
+  u64 next_item = 0;
+
+  for (size_t i = 0; i < MAX_GROUPS; i++) {
+    if (i >= hdr->group_count)
+      break;
+    const struct Group* g = &groups[i];
+
+    if (g->seconds < 1 || g->seconds > MAX_GROUP_SECONDS)
+      return -1;
+    if (g->item_count < 1 || g->item_count > MAX_ITEMS_PER_GROUP)
+      return -1;
+    if ((u64)g->item_start != next_item)
+      return -1;
+    if ((u64)g->item_start + (u64)g->item_count > hdr->item_count)
+      return -1;
+    if (g->expand > MAX_GENERATED_PER_GROUP || g->flags > GROUP_GENERATOR)
+      return -1;
+    if (!g->expand != !(g->flags & GROUP_GENERATOR))
+      return -1;
+    if (g->expand && g->item_count != 1)
+      return -1;
+    if (g->name_length > MAX_LINE_LEN)
+      return -1;
+    if (g->name_offset + (u64)g->name_length > text_len)
+      return -1;
+    for (size_t k = 0; k < MAX_ITEMS_PER_GROUP; k++) {
+      if (k >= g->item_count)
+        break;
+      if (g->name_offset + (u64)items[g->item_start + k].offset >= text_len)
+        return -1;
+    }
+    next_item += g->item_count;
+  }
+  return (next_item == hdr->item_count) ? 0 : -1;
+}
+
+/* Points the session at the tables and text inside its mapped image.
+ * The text is covered only by bounds checks; the stored cksum is what
+ * the deck had when it was compiled and is reused for logging.
+ */
+int image_attach(struct Session* session, char* err_buf, size_t err_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!image_detect(session->map_addr, session->map_len))
+    return set_error(err_buf, err_len, "not a compiled deck");
+
+  const char* base = (const char*)session->map_addr;
+  struct image_header hdr;
+
+  memcpy(&hdr, base, sizeof(hdr));
+  if (check_header(&hdr, sizeof(hdr), session->map_len, 0) != 0)
+    return set_error(err_buf, err_len, "unsupported or damaged compiled deck");
+
+  struct Group* groups =
+      (struct Group*)(void*)((char*)session->map_addr + hdr.group_offset);
+  struct Item* items =
+      (struct Item*)(void*)((char*)session->map_addr + hdr.item_offset);
+
+  if (tables_hash(&hdr, groups, items) != hdr.tables_hash)
+    return set_error(err_buf, err_len, "compiled deck checksum mismatch");
+  if (check_tables(&hdr, groups, items) != 0)
+    return set_error(err_buf, err_len, "compiled deck has invalid tables");
+
+  session->groups = groups;
+  session->group_count = (size_t)hdr.group_count;
+  session->items = items;
+  session->item_count = (size_t)hdr.item_count;
+  session->text = base + hdr.text_offset;
+  session->text_len = (size_t)hdr.text_len;
+  session->text_cksum = hdr.text_cksum;
+  session->has_text_cksum = 1;
+  return 0;
+}
+
+static int write_all(int fd, const void* data, size_t len) {
+  const char* ptr = (const char*)data;
+
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (len == 0)
+      break;
+    ssize_t n = write(fd, ptr, len);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    ptr += (size_t)n;
+    len -= (size_t)n;
+  }
+  return (len == 0) ? 0 : -1;
+}
+
+static int write_image_fd(int fd,
+    const void* hdr,
+    size_t hdr_len,
+    const struct Session* session,
+    int with_text) {
+  if (write_all(fd, hdr, hdr_len) != 0)
+    return -1;
+  if (write_all(fd,
+          session->groups,
+          session->group_count * sizeof(struct Group)) != 0)
+    return -1;
+  if (write_all(
+          fd, session->items, session->item_count * sizeof(struct Item)) != 0)
+    return -1;
+  if (with_text && write_all(fd, session->text, session->text_len) != 0)
+    return -1;
+  return 0;
+}
+
+/* Writes to a temporary file next to `path`, unique to this call, and
+ * renames it over `path`, so readers never see a partial file and
+ * processes writing the same entry do not write into each other's.
+ */
+static int write_image_file(const char* path,
+    const void* hdr,
+    size_t hdr_len,
+    const struct Session* session,
+    int with_text) {
+  char tmp_path[IMAGE_PATH_MAX];
+  int rc = snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+  if (rc < 0 || (size_t)rc >= sizeof(tmp_path))
+    return -1;
+
+  int fd = mkstemp(tmp_path);
+
+  if (fd < 0)
+    return -1;
+
+  /* mkstemp creates the file 0600; give it the mode open() would. */
+  mode_t mask = umask(0);
+
+  (void)umask(mask);
+  rc = 0;
+  if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 ||
+      fchmod(fd, (mode_t)0644 & ~mask) != 0)
+    rc = -1;
+  if (rc == 0)
+    rc = write_image_fd(fd, hdr, hdr_len, session, with_text);
+  if (close(fd) != 0)
+    rc = -1;
+  if (rc == 0 && rename(tmp_path, path) != 0)
+    rc = -1;
+  if (rc != 0)
+    (void)unlink(tmp_path);
+  return rc;
+}
+
+static int fill_header(struct image_header* hdr,
+    const struct Session* session,
+    const char* magic,
+    size_t header_size,
+    int with_text) {
+  if (!assert_ok(session->group_count > 0))
+    return -1;
+  if (!assert_ok(session->item_count > 0))
+    return -1;
+  if (!assert_ok(!session->lazy))
+    return -1;
+
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, magic, IMAGE_MAGIC_LEN);
+  hdr->version = IMAGE_VERSION;
+  hdr->byte_order = IMAGE_BYTE_ORDER;
+  hdr->header_size = (u32)header_size;
+  hdr->group_size = (u32)sizeof(struct Group);
+  hdr->item_size = (u32)sizeof(struct Item);
+  hdr->group_count = (u64)session->group_count;
+  hdr->item_count = (u64)session->item_count;
+  hdr->group_offset = (u64)header_size;
+  hdr->item_offset =
+      hdr->group_offset + hdr->group_count * (u64)sizeof(struct Group);
+  if (with_text)
+    hdr->text_offset =
+        hdr->item_offset + hdr->item_count * (u64)sizeof(struct Item);
+  hdr->text_len = (u64)session->text_len;
+  hdr->text_cksum = session->text_cksum;
+  if (!session->has_text_cksum &&
+      cksum_bytes(&hdr->text_cksum,
+          (const unsigned char*)session->text,
+          session->text_len) != 0)
+    return -1;
+  return 0;
+}
+
+int image_write(const struct Session* session,
+    const char* path,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+
+  struct image_header hdr;
+
+  if (fill_header(&hdr, session, IMAGE_MAGIC, sizeof(hdr), 1) != 0)
+    return set_error(err_buf, err_len, "failed to checksum deck");
+  hdr.tables_hash = tables_hash(&hdr, session->groups, session->items);
+  if (write_image_file(path, &hdr, sizeof(hdr), session, 1) != 0)
+    return set_error(err_buf, err_len, "failed to write compiled deck");
+  return 0;
+}
+
+static u64 index_hash(const struct index_header* idx,
+    const struct Group* groups,
+    const struct Item* items) {
+  u64 h = tables_hash(&idx->image, groups, items);
+
+  return cksum_fast64(h, (const unsigned char*)&idx->id, sizeof(idx->id));
+}
+
+/* Uses a mapped index for the session's deck text. The entry must have
+ * been written for the same file identity and length; anything else is
+ * reported as a miss so the caller parses normally.
+ */
+int image_attach_index(struct Session* session,
+    const void* addr,
+    size_t len,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(addr))
+    return -1;
+  if (!session->has_deck_id)
+    return set_error(err_buf, err_len, "deck has no file identity");
+
+  struct index_header idx;
+
+  if (len < sizeof(idx) || memcmp(addr, INDEX_MAGIC, IMAGE_MAGIC_LEN) != 0)
+    return set_error(err_buf, err_len, "not a deck index");
+  memcpy(&idx, addr, sizeof(idx));
+  if (memcmp(&idx.id, &session->deck_id, sizeof(idx.id)) != 0)
+    return set_error(err_buf, err_len, "stale deck index");
+  if (check_header(&idx.image, sizeof(idx), len, 1) != 0 ||
+      idx.image.text_len != (u64)session->text_len)
+    return set_error(err_buf, err_len, "unsupported or damaged deck index");
+
+  struct Group* groups =
+      (struct Group*)(void*)((char*)addr + idx.image.group_offset);
+  struct Item* items =
+      (struct Item*)(void*)((char*)addr + idx.image.item_offset);
+
+  if (index_hash(&idx, groups, items) != idx.image.tables_hash)
+    return set_error(err_buf, err_len, "deck index checksum mismatch");
+  if (check_tables(&idx.image, groups, items) != 0)
+    return set_error(err_buf, err_len, "deck index has invalid tables");
+
+  session->groups = groups;
+  session->group_count = (size_t)idx.image.group_count;
+  session->items = items;
+  session->item_count = (size_t)idx.image.item_count;
+  session->text_cksum = idx.image.text_cksum;
+  session->has_text_cksum = 1;
+  return 0;
+}
+
+int image_write_index(const struct Session* session,
+    const char* path,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+  if (!session->has_deck_id)
+    return set_error(err_buf, err_len, "deck has no file identity");
+
+  struct index_header idx;
+
+  memset(&idx, 0, sizeof(idx));
+  if (fill_header(&idx.image, session, INDEX_MAGIC, sizeof(idx), 0) != 0)
+    return set_error(err_buf, err_len, "failed to checksum deck");
+  idx.id = session->deck_id;
+  idx.image.tables_hash = index_hash(&idx, session->groups, session->items);
+  if (write_image_file(path, &idx, sizeof(idx), session, 0) != 0)
+    return set_error(err_buf, err_len, "failed to write deck index");
+  return 0;
+}
@@ -1,7 +1,12 @@
 // SPDX-License-Identifier: MIT
 #include "log.h"
+#include "cksum.h"
 #include "config.h"
 #include "model.h"
+#include "parser.h"
+#include "runner.h"
+#include "scan.h"
+#include "term.h"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -12,45 +17,6 @@
 
 static int g_log_fd = -1;
 
-static u32 cksum_update(u32 crc, unsigned char b) {
-  crc ^= (u32)b << 24;
-  for (int i = 0; i < 8; i++) {
-    if (crc & 0x80000000U)
-      crc = (crc << 1) ^ 0x04C11DB7U;
-    else
-      crc <<= 1;
-  }
-  return crc;
-}
-
-static int cksum_bytes(u32* out, const unsigned char* buf, size_t len) {
-  if (!validate_ptr(out))
-    return -1;
-  if (!validate_ptr(buf))
-    return -1;
-  if (!assert_ok(len <= MAX_FILE_BYTES))
-    return -1;
-
-  u32 crc = 0;
-
-  for (size_t i = 0; i < MAX_FILE_BYTES; i++) {
-    if (i >= len)
-      break;
-    crc = cksum_update(crc, buf[i]);
-  }
-
-  size_t n = len;
-
-  for (size_t i = 0; i < sizeof(size_t); i++) {
-    if (n == 0)
-      break;
-    crc = cksum_update(crc, (unsigned char)(n & 0xFF));
-    n >>= 8;
-  }
-  *out = ~crc;
-  return 0;
-}
-
 static size_t sanitize_path(const char* path, char* out, size_t out_len) {
   if (!validate_ptr(out))
     return 0;
@@ -86,7 +52,7 @@ static size_t sanitize_abs_path(const char* path, char* out, size_t out_len) {
     return 0;
   }
 
-  if (path[0] == '/')
+  if (path[0] == '/' || strcmp(path, "-") == 0)
     return sanitize_path(path, out, out_len);
 
   char cwd[256];
@@ -214,52 +180,53 @@ int log_key(int key) {
   return log_write("key", msg);
 }
 
-int log_prompt(
-    const struct Session* session, size_t group_index, size_t item_index) {
+int log_prompt(const struct Session* session,
+    size_t group_index,
+    size_t prompt,
+    const char* text,
+    size_t len,
+    u64 decode_ns) {
   if (!validate_ptr(session))
     return -1;
-  if (!assert_ok(group_index < session->group_count))
+  if (!validate_ptr(text))
     return -1;
-  if (!assert_ok(item_index < session->item_count))
+  if (!assert_ok(group_index < session->group_count))
     return -1;
   if (!assert_ok(group_index < MAX_GROUPS))
     return -1;
-  if (!assert_ok(item_index < MAX_ITEMS_TOTAL))
+  if (!assert_ok(len <= MAX_LINE_LEN))
     return -1;
   if (g_log_fd < 0)
     return 0;
 
   const struct Group* group = &session->groups[group_index];
-  const struct Item* item = &session->items[item_index];
-  const char* buf = session->buffer;
-  u32 group_name_offset = group->name_offset;
+  const char* buf = session->text;
+  u64 group_name_offset = group->name_offset;
   u32 group_name_length = group->name_length;
-  u32 item_offset = item->offset;
-  u32 item_length = item->length;
-
-  size_t group_name_end = (size_t)group_name_offset + (size_t)group_name_length;
+  u64 group_name_end = group_name_offset + (u64)group_name_length;
 
-  if (!assert_ok(group_name_end <= session->buffer_len))
+  if (!assert_ok(group_name_end <= (u64)session->text_len))
     return -1;
 
-  size_t item_end = (size_t)item_offset + (size_t)item_length;
+  /* Generated prompts log their generator line plus the combination. */
+  int generated = group->expand != 0;
+  size_t item_index = group->item_start + (generated ? 0 : prompt);
 
-  if (!assert_ok(item_end <= session->buffer_len))
+  if (!assert_ok(item_index < session->item_count))
     return -1;
 
   const unsigned char* gname = (const unsigned char*)&buf[group_name_offset];
-  const unsigned char* ibytes = (const unsigned char*)&buf[item_offset];
 
   u32 gck = 0;
   int rc = cksum_bytes(&gck, gname, (size_t)group_name_length);
   if (rc != 0)
     return -1;
   u32 ick = 0;
-  rc = cksum_bytes(&ick, ibytes, (size_t)item_length);
+  rc = cksum_bytes(&ick, (const unsigned char*)text, len);
   if (rc != 0)
     return -1;
 
-  char msg[96];
+  char msg[128];
   rc = snprintf(msg,
       sizeof(msg),
       "group=%zu item=%zu gck=%u glen=%u ick=%u ilen=%u",
@@ -268,11 +235,32 @@ int log_prompt(
       gck,
       (unsigned int)group_name_length,
       ick,
-      (unsigned int)item_length);
+      (unsigned int)len);
   if (!assert_ok(rc > 0))
     return -1;
   if (!assert_ok((size_t)rc < sizeof(msg)))
     return -1;
+
+  size_t used = (size_t)rc;
+
+  if (generated) {
+    rc = snprintf(msg + used, sizeof(msg) - used, " gen=%zu", prompt);
+    if (!assert_ok(rc > 0))
+      return -1;
+    if (!assert_ok((size_t)rc < sizeof(msg) - used))
+      return -1;
+    used += (size_t)rc;
+  }
+  if (session->packed) {
+    rc = snprintf(msg + used,
+        sizeof(msg) - used,
+        " decode_ns=%llu",
+        (unsigned long long)decode_ns);
+    if (!assert_ok(rc > 0))
+      return -1;
+    if (!assert_ok((size_t)rc < sizeof(msg) - used))
+      return -1;
+  }
   return log_write("prompt", msg);
 }
 
@@ -312,23 +300,72 @@ int log_shuffle(const char* tag, size_t group_index) {
   return log_write(tag, msg);
 }
 
+int log_frames(size_t skipped) {
+  if (g_log_fd < 0)
+    return 0;
+
+  char msg[64];
+  int rc = snprintf(msg, sizeof(msg), "skipped=%zu", skipped);
+
+  if (!assert_ok(rc > 0))
+    return -1;
+  if (!assert_ok((size_t)rc < sizeof(msg)))
+    return -1;
+  return log_write("frames", msg);
+}
+
+int log_draw(const struct TermScreen* screen) {
+  if (!validate_ptr(screen))
+    return -1;
+  if (g_log_fd < 0)
+    return 0;
+
+  u64 shown = (screen->frames > 0) ? screen->frames : 1U;
+  /* Hundredths, to stay in integers. */
+  u64 per_frame = screen->writes * 100U / shown;
+  char msg[256];
+  int rc = snprintf(msg,
+      sizeof(msg),
+      "frames=%llu diffs=%llu dropped=%llu writes=%llu "
+      "per_frame=%llu.%02llu bytes=%llu stall_us=%llu max_stall_us=%llu",
+      (unsigned long long)screen->frames,
+      (unsigned long long)screen->diffs,
+      (unsigned long long)screen->dropped,
+      (unsigned long long)screen->writes,
+      (unsigned long long)(per_frame / 100U),
+      (unsigned long long)(per_frame % 100U),
+      (unsigned long long)screen->bytes,
+      (unsigned long long)(screen->stalled_ns / 1000U),
+      (unsigned long long)(screen->max_stall_ns / 1000U));
+
+  if (!assert_ok(rc > 0))
+    return -1;
+  if (!assert_ok((size_t)rc < sizeof(msg)))
+    return -1;
+  return log_write("draw", msg);
+}
+
 int log_input(const struct Session* session, const char* path) {
   if (!validate_ptr(session))
     return -1;
   if (g_log_fd < 0)
     return 0;
-  size_t len = session->buffer_len;
-  const char* buf = session->buffer;
+  size_t len = session->text_len;
+  const char* buf = session->text;
 
-  if (!assert_ok(len <= MAX_FILE_BYTES))
+  if (!assert_ok((u64)len <= MAX_DECK_BYTES))
     return -1;
-  if (!assert_ok(buf[len] == '\0'))
+  if (!validate_ptr(buf))
     return -1;
 
-  u32 ck = 0;
-  int rc = cksum_bytes(&ck, (const unsigned char*)buf, len);
-  if (rc != 0)
-    return -1;
+  u32 ck = session->text_cksum;
+  int rc = 0;
+
+  if (!session->has_text_cksum) {
+    rc = cksum_bytes(&ck, (const unsigned char*)buf, len);
+    if (rc != 0)
+      return -1;
+  }
 
   char safe_path[192];
   size_t have_path = sanitize_abs_path(path, safe_path, sizeof(safe_path));
@@ -347,6 +384,162 @@ int log_input(const struct Session* session, const char* path) {
   return log_write("file", msg);
 }
 
+int log_parse(const struct Session* session) {
+  if (!validate_ptr(session))
+    return -1;
+  if (g_log_fd < 0)
+    return 0;
+
+  u64 ns = session->parse_ns;
+  u64 bytes = (u64)session->text_len;
+  /* bytes per ns == GB/s; reported in MB/s to stay in integers */
+  u64 mbps = (ns > 0) ? (bytes * 1000ULL) / ns : 0;
+  char msg[128];
+  int rc = snprintf(msg,
+      sizeof(msg),
+      "bytes=%llu ns=%llu mbps=%llu scan=%s",
+      (unsigned long long)bytes,
+      (unsigned long long)ns,
+      (unsigned long long)mbps,
+      scan_level_name(scan_detect()));
+
+  if (!assert_ok(rc > 0))
+    return -1;
+  if (!assert_ok((size_t)rc < sizeof(msg)))
+    return -1;
+  return log_write("parse", msg);
+}
+
+int log_ingest(const struct Session* session) {
+  if (!validate_ptr(session))
+    return -1;
+  if (g_log_fd < 0)
+    return 0;
+  /* Mapped files and images have no read stage to report. */
+  if (session->ingest.blocks == 0)
+    return 0;
+
+  const struct IngestStats* st = &session->ingest;
+  char msg[160];
+  int rc = snprintf(msg,
+      sizeof(msg),
+      "read_ns=%llu parse_ns=%llu wait_ns=%llu wall_ns=%llu blocks=%llu "
+      "pipelined=%d",
+      (unsigned long long)st->read_ns,
+      (unsigned long long)st->parse_ns,
+      (unsigned long long)st->wait_ns,
+      (unsigned long long)session->parse_ns,
+      (unsigned long long)st->blocks,
+      st->pipelined);
+
+  if (!assert_ok(rc > 0))
+    return -1;
+  if (!assert_ok((size_t)rc < sizeof(msg)))
+    return -1;
+  return log_write("ingest", msg);
+}
+
+int log_pack(const struct Session* session) {
+  if (!validate_ptr(session))
+    return -1;
+  if (g_log_fd < 0)
+    return 0;
+
+  const struct PackStats* st = &session->pack;
+  u64 text = (st->text_bytes > 0) ? st->text_bytes : 1U;
+  char msg[128];
+  int rc = snprintf(msg,
+      sizeof(msg),
+      "bytes=%llu packed=%llu percent=%llu ns=%llu",
+      (unsigned long long)st->text_bytes,
+      (unsigned long long)st->packed_bytes,
+      (unsigned long long)(st->packed_bytes * 100U / text),
+      (unsigned long long)st->ns);
+
+  if (!assert_ok(rc > 0))
+    return -1;
+  if (!assert_ok((size_t)rc < sizeof(msg)))
+    return -1;
+  return log_write("pack", msg);
+}
+
+int log_tables(const struct Session* session, const struct RunOrders* orders) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(orders))
+    return -1;
+  if (g_log_fd < 0)
+    return 0;
+
+  /* Entries in use; a watched deck reserves room for more. */
+  u64 prompts = 0;
+
+  for (size_t g = 0; g < MAX_GROUPS; g++) {
+    if (g >= session->group_count)
+      break;
+    size_t count = session_prompt_count(session, g);
+
+    if (count > prompts)
+      prompts = count;
+  }
+
+  u64 order_bytes = (u64)session->group_count * sizeof(orders->cursors[0]);
+
+  if (orders->groups.values)
+    order_bytes += ((u64)session->group_count + prompts) *
+        (u64)(sizeof(orders->items.values[0]) +
+            sizeof(orders->items.stamps[0]));
+  u64 group_bytes = (u64)session->group_count * sizeof(struct Group);
+  u64 item_bytes = (u64)session->item_count * sizeof(struct Item);
+  u64 total = group_bytes + item_bytes + order_bytes;
+  u64 items = (session->item_count > 0) ? (u64)session->item_count : 1U;
+  /* Hundredths of a byte, to stay in integers. */
+  u64 per_item = total * 100U / items;
+  char msg[192];
+  int rc = snprintf(msg,
+      sizeof(msg),
+      "groups=%zu items=%zu group_bytes=%llu item_bytes=%llu "
+      "order_bytes=%llu per_item=%llu.%02llu",
+      session->group_count,
+      session->item_count,
+      (unsigned long long)group_bytes,
+      (unsigned long long)item_bytes,
+      (unsigned long long)order_bytes,
+      (unsigned long long)(per_item / 100U),
+      (unsigned long long)(per_item % 100U));
+
+  if (!assert_ok(rc > 0))
+    return -1;
+  if (!assert_ok((size_t)rc < sizeof(msg)))
+    return -1;
+  return log_write("tables", msg);
+}
+
+int log_reload(const struct Session* session, const struct ReloadMap* map) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(map))
+    return -1;
+  if (g_log_fd < 0)
+    return 0;
+
+  char msg[160];
+  int rc = snprintf(msg,
+      sizeof(msg),
+      "bytes=%zu parsed=%zu groups=%zu items=%zu ns=%llu",
+      session->text_len,
+      map->parsed_bytes,
+      session->group_count,
+      session->item_count,
+      (unsigned long long)map->ns);
+
+  if (!assert_ok(rc > 0))
+    return -1;
+  if (!assert_ok((size_t)rc < sizeof(msg)))
+    return -1;
+  return log_write("reload", msg);
+}
+
 int log_open(const struct Session* session) {
   if (!validate_ptr(session))
     return -1;
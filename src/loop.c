@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: MIT
+#include "loop.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/* stdin, terminal output, timer, signals and watch. */
+#define LOOP_MAX_SOURCES 5
+/* Signals queued between two wakeups. */
+#define LOOP_SIGNAL_BATCH 8U
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ptr(msg))
+    return -1;
+
+  int rc = snprintf(err_buf, err_len, "%s", msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static int add_source(int epoll_fd, int fd) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void close_fd(int* fd) {
+  if (*fd >= 0)
+    (void)close(*fd);
+  *fd = -1;
+}
+
+int loop_open(struct EventLoop* loop,
+    int watch_fd,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!validate_ok(watch_fd >= -1))
+    return -1;
+
+  sigset_t mask;
+
+  loop->epoll_fd = -1;
+  loop->timer_fd = -1;
+  loop->signal_fd = -1;
+  loop->watch_fd = watch_fd;
+  loop->output_fd = -1;
+  loop->active = 0;
+  if (sigemptyset(&mask) != 0 || sigaddset(&mask, SIGINT) != 0 ||
+      sigaddset(&mask, SIGTERM) != 0 || sigaddset(&mask, SIGHUP) != 0 ||
+      sigaddset(&mask, SIGWINCH) != 0)
+    return set_error(err_buf, err_len, "failed to set up signals");
+  /* Blocked signals stay pending for the signalfd instead of running
+   * their default action.
+   */
+  if (sigprocmask(SIG_BLOCK, &mask, &loop->saved_mask) != 0)
+    return set_error(err_buf, err_len, "failed to block signals");
+
+  loop->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+  int rc = 0;
+
+  if (loop->signal_fd < 0 || loop->timer_fd < 0 || loop->epoll_fd < 0)
+    rc = -1;
+  if (rc == 0)
+    rc = add_source(loop->epoll_fd, STDIN_FILENO);
+  if (rc == 0)
+    rc = add_source(loop->epoll_fd, loop->timer_fd);
+  if (rc == 0)
+    rc = add_source(loop->epoll_fd, loop->signal_fd);
+  if (rc == 0 && watch_fd >= 0)
+    rc = add_source(loop->epoll_fd, watch_fd);
+  if (rc != 0) {
+    close_fd(&loop->epoll_fd);
+    close_fd(&loop->timer_fd);
+    close_fd(&loop->signal_fd);
+    (void)sigprocmask(SIG_SETMASK, &loop->saved_mask, NULL);
+    return set_error(err_buf, err_len, "failed to set up the event loop");
+  }
+  loop->active = 1;
+  return 0;
+}
+
+int loop_close(struct EventLoop* loop) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!loop->active)
+    return 0;
+
+  int rc = 0;
+
+  if (close(loop->epoll_fd) != 0)
+    rc = -1;
+  if (close(loop->timer_fd) != 0)
+    rc = -1;
+  if (close(loop->signal_fd) != 0)
+    rc = -1;
+  loop->epoll_fd = -1;
+  loop->timer_fd = -1;
+  loop->signal_fd = -1;
+  loop->output_fd = -1;
+  loop->active = 0;
+  if (sigprocmask(SIG_SETMASK, &loop->saved_mask, NULL) != 0)
+    rc = -1;
+  return rc;
+}
+
+int loop_arm_timer(struct EventLoop* loop, unsigned int seconds) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!assert_ok(loop->active))
+    return -1;
+  if (!validate_ok(seconds > 0 && seconds <= MAX_GROUP_SECONDS))
+    return -1;
+
+  struct itimerspec spec;
+
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = (time_t)seconds;
+  return timerfd_settime(loop->timer_fd, 0, &spec, NULL);
+}
+
+int loop_watch_output(struct EventLoop* loop, int fd, int on) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!assert_ok(loop->active))
+    return -1;
+  if (!validate_ok(fd >= 0))
+    return -1;
+  if (!on == !(loop->output_fd >= 0))
+    return 0;
+  if (!assert_ok(on || fd == loop->output_fd))
+    return -1;
+
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLOUT;
+  ev.data.fd = fd;
+  if (epoll_ctl(
+          loop->epoll_fd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &ev) != 0)
+    return -1;
+  loop->output_fd = on ? fd : -1;
+  return 0;
+}
+
+/* End of the terminal reply starting at keys[i] (ESC [ ? params, then
+ * `c` for device attributes or `$y` for a mode report), i if none does.
+ */
+static size_t reply_end(const unsigned char* keys, size_t count, size_t i) {
+  if (i + 3U >= count || keys[i] != '\033' || keys[i + 1U] != '[' ||
+      keys[i + 2U] != '?')
+    return i;
+
+  for (size_t j = i + 3U; j < LOOP_KEY_BATCH; j++) {
+    if (j >= count)
+      break;
+    unsigned char ch = keys[j];
+
+    if (ch == 'c')
+      return j + 1U;
+    if (ch == '$')
+      return (j + 1U < count && keys[j + 1U] == 'y') ? j + 2U : i;
+    if (ch != ';' && (ch < '0' || ch > '9'))
+      break;
+  }
+  return i;
+}
+
+static size_t drop_replies(unsigned char* keys, size_t count) {
+  size_t kept = 0;
+  size_t skip = 0;
+
+  for (size_t i = 0; i < LOOP_KEY_BATCH; i++) {
+    if (i >= count)
+      break;
+    if (skip > 0) {
+      skip--;
+      continue;
+    }
+    size_t end = reply_end(keys, count, i);
+
+    if (end > i) {
+      skip = end - i - 1U;
+      continue;
+    }
+    keys[kept++] = keys[i];
+  }
+  return kept;
+}
+
+static int read_keys(struct LoopEvents* out) {
+  ssize_t n = read(STDIN_FILENO, out->keys, LOOP_KEY_BATCH);
+
+  if (n < 0)
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+  /* Readable with nothing to read: the terminal is gone. */
+  if (n == 0)
+    return -1;
+  out->key_count = drop_replies(out->keys, (size_t)n);
+  return 0;
+}
+
+static int read_timer(const struct EventLoop* loop, struct LoopEvents* out) {
+  unsigned long long expirations = 0;
+  ssize_t n = read(loop->timer_fd, &expirations, sizeof(expirations));
+
+  if (n < 0)
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+  if (!assert_ok(n == (ssize_t)sizeof(expirations)))
+    return -1;
+  out->expired = 1;
+  return 0;
+}
+
+static int read_signals(const struct EventLoop* loop, struct LoopEvents* out) {
+  for (size_t i = 0; i < LOOP_SIGNAL_BATCH; i++) {
+    struct signalfd_siginfo info;
+    ssize_t n = read(loop->signal_fd, &info, sizeof(info));
+
+    if (n < 0)
+      return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    if (!assert_ok(n == (ssize_t)sizeof(info)))
+      return -1;
+    if (info.ssi_signo == SIGWINCH)
+      out->resized = 1;
+    else
+      out->quit = 1;
+  }
+  return 0;
+}
+
+int loop_wait(struct EventLoop* loop, struct LoopEvents* out) {
+  if (!validate_ptr(loop))
+    return -1;
+  if (!validate_ptr(out))
+    return -1;
+  if (!assert_ok(loop->active))
+    return -1;
+
+  struct epoll_event events[LOOP_MAX_SOURCES];
+
+  out->key_count = 0;
+  out->expired = 0;
+  out->changed = 0;
+  out->quit = 0;
+  out->resized = 0;
+  out->writable = 0;
+
+  int ready = epoll_wait(loop->epoll_fd, events, LOOP_MAX_SOURCES, -1);
+
+  if (ready < 0)
+    return (errno == EINTR) ? 0 : -1;
+  for (int i = 0; i < LOOP_MAX_SOURCES; i++) {
+    if (i >= ready)
+      break;
+    int fd = events[i].data.fd;
+    int rc = 0;
+
+    if (fd == STDIN_FILENO)
+      rc = read_keys(out);
+    else if (fd == loop->timer_fd)
+      rc = read_timer(loop, out);
+    else if (fd == loop->signal_fd)
+      rc = read_signals(loop, out);
+    else if (fd == loop->watch_fd)
+      out->changed = 1;
+    else if (fd == loop->output_fd)
+      out->writable = 1;
+    if (rc != 0)
+      return -1;
+  }
+  return 0;
+}
@@ -1,12 +1,240 @@
 // SPDX-License-Identifier: MIT
 #include "model.h"
+#include "gen.h"
+#include "pack.h"
+#include "scan.h"
+
+#include <string.h>
+#include <sys/mman.h>
 
 int session_init(struct Session* session) {
   if (!assert_ptr(session))
     return -1;
 
-  session->buffer_len = 0;
+  session->text = NULL;
+  session->text_len = 0;
+  session->map_addr = NULL;
+  session->map_len = 0;
+  session->spare_addr = NULL;
+  session->spare_len = 0;
+  memset(&session->deck_id, 0, sizeof(session->deck_id));
+  session->has_deck_id = 0;
+  session->index_addr = NULL;
+  session->index_len = 0;
+  session->from_cache = 0;
+  session->groups = NULL;
+  session->group_count = 0;
+  session->items = NULL;
+  session->item_count = 0;
+  session->group_cap = 0;
+  session->item_cap = 0;
+  session->lazy = 0;
+  session->parse_ns = 0;
+  session->ingest.read_ns = 0;
+  session->ingest.parse_ns = 0;
+  session->ingest.wait_ns = 0;
+  session->ingest.blocks = 0;
+  session->ingest.pipelined = 0;
+  session->text_cksum = 0;
+  session->has_text_cksum = 0;
+  session->arena.base = NULL;
+  session->arena.len = 0;
+  session->arena.used = 0;
+  session->packed = 0;
+  session->pack.text_bytes = 0;
+  session->pack.packed_bytes = 0;
+  session->pack.ns = 0;
+  return 0;
+}
+
+int session_reserve(
+    struct Session* session, size_t group_cap, size_t item_cap) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ok(session->arena.base == NULL))
+    return -1;
+  if (!validate_ok(group_cap > 0 && group_cap <= MAX_GROUPS))
+    return -1;
+  if (!validate_ok(item_cap > 0 && item_cap <= MAX_ITEMS_TOTAL))
+    return -1;
+
+  size_t group_bytes = arena_bytes(group_cap, sizeof(struct Group));
+  size_t item_bytes = arena_bytes(item_cap, sizeof(struct Item));
+
+  if (group_bytes == 0 || item_bytes == 0)
+    return -1;
+  if (arena_init(&session->arena, group_bytes + item_bytes) != 0)
+    return -1;
+  session->groups =
+      arena_take(&session->arena, group_cap, sizeof(struct Group));
+  session->items = arena_take(&session->arena, item_cap, sizeof(struct Item));
+  if (!assert_ptr(session->groups) || !assert_ptr(session->items))
+    return -1;
+  session->group_cap = group_cap;
+  session->item_cap = item_cap;
+  return 0;
+}
+
+int session_grow(struct Session* session, size_t group_cap, size_t item_cap) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ok(session->arena.base != NULL))
+    return -1;
+  if (!validate_ok(group_cap >= session->group_count))
+    return -1;
+  if (!validate_ok(item_cap >= session->item_count))
+    return -1;
+
+  struct Arena old = session->arena;
+  struct Group* groups = session->groups;
+  struct Item* items = session->items;
+  size_t old_group_cap = session->group_cap;
+  size_t old_item_cap = session->item_cap;
+
+  session->arena.base = NULL;
+  if (session_reserve(session, group_cap, item_cap) != 0) {
+    if (session->arena.base)
+      (void)arena_release(&session->arena);
+    session->arena = old;
+    session->groups = groups;
+    session->items = items;
+    session->group_cap = old_group_cap;
+    session->item_cap = old_item_cap;
+    return -1;
+  }
+  memcpy(session->groups, groups, session->group_count * sizeof(struct Group));
+  memcpy(session->items, items, session->item_count * sizeof(struct Item));
+  return arena_release(&old);
+}
+
+int session_release(struct Session* session) {
+  if (!assert_ptr(session))
+    return -1;
+
+  int rc = 0;
+
+  if (session->map_addr)
+    rc = munmap(session->map_addr, session->map_len);
+  if (session->index_addr && munmap(session->index_addr, session->index_len))
+    rc = -1;
+  if (session->spare_addr && munmap(session->spare_addr, session->spare_len))
+    rc = -1;
+  session->spare_addr = NULL;
+  session->spare_len = 0;
+  session->map_addr = NULL;
+  session->map_len = 0;
+  session->has_deck_id = 0;
+  session->index_addr = NULL;
+  session->index_len = 0;
+  session->from_cache = 0;
+  session->text = NULL;
+  session->text_len = 0;
+  if (arena_release(&session->arena) != 0)
+    rc = -1;
+  session->groups = NULL;
   session->group_count = 0;
+  session->items = NULL;
   session->item_count = 0;
+  session->group_cap = 0;
+  session->item_cap = 0;
+  session->lazy = 0;
+  session->packed = 0;
+  if (rc != 0)
+    return -1;
   return 0;
 }
+
+int session_line(const struct Session* session,
+    size_t group_index,
+    size_t index,
+    char* buf,
+    const char** out_text,
+    size_t* out_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(out_text))
+    return -1;
+  if (!validate_ptr(out_len))
+    return -1;
+  if (!assert_ok(group_index < session->group_count))
+    return -1;
+  if (session->packed) {
+    if (pack_line(session, group_index, index, buf, out_text, out_len) != 0)
+      return -1;
+    return assert_ok(*out_len > 0) ? 0 : -1;
+  }
+
+  const struct Group* group = &session->groups[group_index];
+
+  if (!assert_ok(index < group->item_count))
+    return -1;
+
+  u64 start = group->name_offset +
+      (u64)session->items[group->item_start + index].offset;
+
+  if (!assert_ok(start < (u64)session->text_len))
+    return -1;
+
+  size_t len = scan_line_length(session->text,
+      session->text_len,
+      (size_t)start);
+
+  if (!assert_ok(len > 0 && len <= MAX_LINE_LEN))
+    return -1;
+  *out_text = session->text + start;
+  *out_len = len;
+  return 0;
+}
+
+size_t session_prompt_count(const struct Session* session, size_t group_index) {
+  if (!validate_ptr(session))
+    return 0;
+  if (!assert_ok(group_index < session->group_count))
+    return 0;
+
+  const struct Group* group = &session->groups[group_index];
+
+  if (group->item_count == 0)
+    return 0;
+  return group->expand ? (size_t)group->expand : (size_t)group->item_count;
+}
+
+int session_prompt(const struct Session* session,
+    size_t group_index,
+    size_t prompt,
+    char* buf,
+    const char** out_text,
+    size_t* out_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(buf))
+    return -1;
+  if (!validate_ptr(out_text))
+    return -1;
+  if (!validate_ptr(out_len))
+    return -1;
+  if (!assert_ok(prompt < session_prompt_count(session, group_index)))
+    return -1;
+
+  const struct Group* group = &session->groups[group_index];
+  size_t line = group->expand ? 0 : prompt;
+
+  if (session_line(session, group_index, line, buf, out_text, out_len) != 0)
+    return -1;
+  if (!group->expand)
+    return 0;
+  /* Generators share no prefix, so the line is not in buf. */
+  if (!assert_ok(*out_text != buf))
+    return -1;
+
+  /* Decoding the line is O(line length), independent of the expansion. */
+  struct Generator gen;
+  const char* why = NULL;
+
+  if (gen_parse(&gen, *out_text, *out_len, &why) != 0)
+    return -1;
+  if (!assert_ok(gen.total == (u64)group->expand))
+    return -1;
+  *out_text = buf;
+  return gen_render(&gen, (u64)prompt, buf, MAX_LINE_LEN, out_len);
+}
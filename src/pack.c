@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: MIT
+#include "pack.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define LEB128_MAX_BYTES 5U
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ptr(msg))
+    return -1;
+
+  int rc = snprintf(err_buf, err_len, "%s", msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+static u64 now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+static size_t put_length(char* out, u32 value) {
+  size_t n = 0;
+
+  for (size_t k = 0; k < LEB128_MAX_BYTES; k++) {
+    unsigned char byte = (unsigned char)(value & 0x7fU);
+
+    value >>= 7;
+    if (value != 0)
+      byte |= 0x80U;
+    out[n++] = (char)byte;
+    if (value == 0)
+      break;
+  }
+  return n;
+}
+
+/* Reads a length from p[0, avail); returns the bytes used, 0 if invalid. */
+static size_t get_length(const char* p, size_t avail, u32* out) {
+  u32 value = 0;
+
+  for (size_t k = 0; k < LEB128_MAX_BYTES; k++) {
+    if (k >= avail)
+      break;
+    unsigned char byte = (unsigned char)p[k];
+
+    value |= (u32)(byte & 0x7fU) << (7U * k);
+    if ((byte & 0x80U) == 0) {
+      *out = value;
+      return k + 1U;
+    }
+  }
+  return 0;
+}
+
+static size_t shared_prefix(
+    const char* a, size_t a_len, const char* b, size_t b_len) {
+  size_t n = (a_len < b_len) ? a_len : b_len;
+
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (i >= n || a[i] != b[i])
+      return i;
+  }
+  return n;
+}
+
+/* Writes the group's name and lines to out[*used...]. */
+static int pack_group(const struct Session* session,
+    size_t group_index,
+    struct Group* dst,
+    struct Item* items,
+    char* out,
+    size_t* used) {
+  const struct Group* src = &session->groups[group_index];
+  size_t pos = *used;
+  const char* prev = NULL;
+  size_t prev_len = 0;
+
+  *dst = *src;
+  dst->name_offset = (u64)pos;
+  memcpy(out + pos, session->text + src->name_offset, src->name_length);
+  pos += src->name_length;
+  for (size_t k = 0; k < MAX_ITEMS_PER_GROUP; k++) {
+    if (k >= src->item_count)
+      break;
+    const char* line = NULL;
+    size_t len = 0;
+
+    if (session_line(session, group_index, k, NULL, &line, &len) != 0)
+      return -1;
+
+    size_t prefix = 0;
+
+    if (k % PACK_RESTART != 0)
+      prefix = shared_prefix(prev, prev_len, line, len);
+    if ((u64)(pos - *used) > MAX_GROUP_BYTES)
+      return -1;
+    items[src->item_start + k].offset = (u32)(pos - *used);
+    pos += put_length(out + pos, (u32)prefix);
+    pos += put_length(out + pos, (u32)(len - prefix));
+    memcpy(out + pos, line + prefix, len - prefix);
+    pos += len - prefix;
+    prev = line;
+    prev_len = len;
+  }
+  *used = pos;
+  return 0;
+}
+
+/* Drops the storage the session used before it was packed. */
+static int release_unpacked(struct Session* session) {
+  int rc = 0;
+
+  if (session->map_addr && munmap(session->map_addr, session->map_len))
+    rc = -1;
+  if (session->index_addr && munmap(session->index_addr, session->index_len))
+    rc = -1;
+  session->map_addr = NULL;
+  session->map_len = 0;
+  session->index_addr = NULL;
+  session->index_len = 0;
+  if (arena_release(&session->arena) != 0)
+    rc = -1;
+  return rc;
+}
+
+int pack_session(struct Session* session, char* err_buf, size_t err_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ok(!session->lazy && !session->packed))
+    return -1;
+  if (!validate_ok(!session->spare_addr))
+    return -1;
+
+  u64 t0 = now_ns();
+  size_t group_count = session->group_count;
+  size_t item_count = session->item_count;
+  /* Names and lines are disjoint parts of the text; each line gains at
+   * most an entry header and loses its '\n'.
+   */
+  size_t text_bound = session->text_len + item_count * PACK_ENTRY_HEADER_MAX;
+  size_t bytes = arena_bytes(group_count, sizeof(struct Group)) +
+      arena_bytes(item_count, sizeof(struct Item)) +
+      arena_bytes(text_bound, 1U);
+  struct Arena arena;
+
+  if (arena_init(&arena, bytes) != 0)
+    return set_error(err_buf, err_len, "failed to reserve packed text memory");
+
+  struct Group* groups =
+      arena_take(&arena, group_count, sizeof(struct Group));
+  struct Item* items = arena_take(&arena, item_count, sizeof(struct Item));
+  char* out = arena_take(&arena, text_bound, 1U);
+  size_t used = 0;
+
+  if (!assert_ptr(groups) || !assert_ptr(items) || !assert_ptr(out)) {
+    (void)arena_release(&arena);
+    return -1;
+  }
+  for (size_t g = 0; g < MAX_GROUPS; g++) {
+    if (g >= group_count)
+      break;
+    if (pack_group(session, g, &groups[g], items, out, &used) != 0) {
+      (void)arena_release(&arena);
+      return set_error(err_buf, err_len, "failed to pack deck text");
+    }
+  }
+
+  session->pack.text_bytes = (u64)session->text_len;
+  if (release_unpacked(session) != 0) {
+    (void)arena_release(&arena);
+    return -1;
+  }
+  session->arena = arena;
+  session->groups = groups;
+  session->group_cap = group_count;
+  session->items = items;
+  session->item_cap = item_count;
+  session->text = out;
+  session->text_len = used;
+  session->packed = 1;
+  session->pack.packed_bytes = (u64)used;
+  session->pack.ns = now_ns() - t0;
+  return 0;
+}
+
+int pack_line(const struct Session* session,
+    size_t group_index,
+    size_t index,
+    char* buf,
+    const char** out_text,
+    size_t* out_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(out_text))
+    return -1;
+  if (!validate_ptr(out_len))
+    return -1;
+  if (!assert_ok(session->packed))
+    return -1;
+  if (!assert_ok(group_index < session->group_count))
+    return -1;
+
+  const struct Group* group = &session->groups[group_index];
+
+  if (!assert_ok(index < group->item_count))
+    return -1;
+
+  const struct Item* items = &session->items[group->item_start];
+  size_t first = index - index % PACK_RESTART;
+  size_t len = 0;
+
+  for (size_t k = first; k < first + PACK_RESTART; k++) {
+    if (k > index)
+      break;
+    u64 pos = group->name_offset + (u64)items[k].offset;
+
+    if (!assert_ok(pos < (u64)session->text_len))
+      return -1;
+
+    const char* p = session->text + pos;
+    size_t avail = session->text_len - (size_t)pos;
+    u32 prefix = 0;
+    u32 suffix = 0;
+    size_t n = get_length(p, avail, &prefix);
+    size_t m = (n > 0) ? get_length(p + n, avail - n, &suffix) : 0;
+
+    if (!assert_ok(m > 0 && suffix <= avail - n - m))
+      return -1;
+    n += m;
+    if (!assert_ok(prefix <= len && prefix + suffix <= MAX_LINE_LEN))
+      return -1;
+    /* A line that shares nothing is stored whole. */
+    if (k == index && prefix == 0) {
+      *out_text = p + n;
+      *out_len = suffix;
+      return 0;
+    }
+    if (!validate_ptr(buf))
+      return -1;
+    memcpy(buf + prefix, p + n, suffix);
+    len = prefix + suffix;
+  }
+  if (!assert_ok(len > 0))
+    return -1;
+  *out_text = buf;
+  *out_len = len;
+  return 0;
+}
@@ -1,16 +1,40 @@
 // SPDX-License-Identifier: MIT
 #include "parser.h"
+#include "cache.h"
+#include "gen.h"
+#include "image.h"
+#include "scan.h"
 
-#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 struct parse_state {
   size_t line_no;
   int has_group;
   size_t current_group;
+  /* Set while group 0 stands in for a group opened in an earlier chunk. */
+  int carry_open;
+};
+
+/* Where parsed groups/items go: the session arrays, or a worker's slice
+ * of the shared scratch tables in a parallel parse.
+ */
+struct parse_tables {
+  struct Group* groups;
+  size_t group_count;
+  size_t group_cap;
+  struct Item* items;
+  size_t item_count;
+  size_t item_cap;
 };
 
 static int set_error(char* err_buf, size_t err_len, const char* msg) {
@@ -53,7 +77,7 @@ static size_t trim_left_index(const char* line, size_t line_len) {
   for (size_t i = 0; i < MAX_LINE_LEN; i++) {
     if (i >= line_len)
       break;
-    if (!isspace((unsigned char)line[i]))
+    if (!scan_is_space((unsigned char)line[i]))
       return i;
   }
   return line_len;
@@ -73,26 +97,13 @@ static size_t trim_right_index(
       break;
     if (end <= start || end == 0)
       break;
-    if (!isspace((unsigned char)line[end - 1]))
+    if (!scan_is_space((unsigned char)line[end - 1]))
       break;
     end--;
   }
   return end;
 }
 
-static int is_blank_or_comment(const char* line, size_t line_len) {
-  if (!validate_ptr(line))
-    return 1;
-  if (!validate_ok(line_len <= MAX_LINE_LEN))
-    return 1;
-
-  size_t start = trim_left_index(line, line_len);
-
-  if (start >= line_len)
-    return 1;
-  return line[start] == '#';
-}
-
 static int find_pipe_index(
     const char* line, size_t line_len, size_t* out_index) {
   if (!validate_ptr(line))
@@ -112,6 +123,7 @@ static int find_pipe_index(
 }
 
 static int parse_seconds_value(const char* sec,
+    size_t sec_len,
     size_t line_no,
     char* err_buf,
     size_t err_len,
@@ -121,24 +133,60 @@ static int parse_seconds_value(const char* sec,
   if (!validate_ptr(out_seconds))
     return -1;
 
-  errno = 0;
-  char* endptr = NULL;
-  unsigned long secs = strtoul(sec, &endptr, 10);
+  /* Same accepted forms as strtoul(base 10) on a trimmed field. */
+  size_t start = 0;
 
-  if (errno != 0 || !endptr || *endptr != '\0' || secs < 1 ||
-      secs > MAX_GROUP_SECONDS)
+  if (sec_len > 0 && sec[0] == '+')
+    start = 1;
+  if (start >= sec_len)
+    return set_error_line(err_buf, err_len, line_no, "invalid seconds value");
+
+  unsigned long secs = 0;
+
+  for (size_t i = start; i < MAX_LINE_LEN; i++) {
+    if (i >= sec_len)
+      break;
+    unsigned char ch = (unsigned char)sec[i];
+
+    if (ch < '0' || ch > '9')
+      return set_error_line(
+          err_buf, err_len, line_no, "invalid seconds value");
+    secs = secs * 10UL + (unsigned long)(ch - '0');
+    if (secs > MAX_GROUP_SECONDS)
+      return set_error_line(
+          err_buf, err_len, line_no, "invalid seconds value");
+  }
+  if (secs < 1)
     return set_error_line(err_buf, err_len, line_no, "invalid seconds value");
   *out_seconds = (unsigned int)secs;
   return 0;
 }
 
-static int parse_header_line(struct Session* session,
-    char* line,
+/* The optional third header field. */
+#define HEADER_GENERATE "generate"
+
+/* Reads the optional third field of a header, from its second '|' up to
+ * the closing ']': GROUP_GENERATOR for `generate`, -1 for anything else.
+ */
+static int parse_header_flags(const char* field, size_t len, u32* flags) {
+  size_t start = trim_left_index(field, len);
+  size_t end = trim_right_index(field, len, start);
+  size_t want = sizeof(HEADER_GENERATE) - 1U;
+
+  if (end - start != want || memcmp(field + start, HEADER_GENERATE, want))
+    return -1;
+  *flags = GROUP_GENERATOR;
+  return 0;
+}
+
+static int parse_header_line(struct parse_tables* t,
+    const char* line,
     size_t line_len,
+    size_t line_start,
     size_t line_no,
     char* err_buf,
     size_t err_len) {
-  if (!validate_ptr(session))
+  if (!validate_ptr(t))
     return -1;
   if (!validate_ptr(line))
     return -1;
@@ -154,197 +202,303 @@ static int parse_header_line(struct Session* session,
   if (rc != 0)
     return set_error_line(err_buf, err_len, line_no, "malformed header");
 
-  line[line_len - 1] = '\0';
-  line[pipe_index] = '\0';
-
-  char* name = line + 1;
+  const char* name = line + 1;
   size_t name_len = pipe_index - 1;
   size_t name_start = trim_left_index(name, name_len);
   size_t name_end = trim_right_index(name, name_len, name_start);
 
   if (name_start >= name_end)
     return set_error_line(err_buf, err_len, line_no, "malformed header");
-  name[name_end] = '\0';
-  name += name_start;
 
-  char* sec = line + pipe_index + 1;
-  size_t sec_len = (line_len - 1) - (pipe_index + 1);
+  size_t field_end = line_len - 1;
+  size_t next_pipe = 0;
+  u32 flags = 0;
+
+  rc = find_pipe_index(line + pipe_index, line_len - pipe_index, &next_pipe);
+  if (rc == 0) {
+    field_end = pipe_index + next_pipe;
+    rc = parse_header_flags(
+        line + field_end + 1, (line_len - 1) - (field_end + 1), &flags);
+    if (rc != 0)
+      return set_error_line(err_buf, err_len, line_no, "malformed header");
+  }
+
+  const char* sec = line + pipe_index + 1;
+  size_t sec_len = field_end - (pipe_index + 1);
   size_t sec_start = trim_left_index(sec, sec_len);
   size_t sec_end = trim_right_index(sec, sec_len, sec_start);
 
   if (sec_start >= sec_end)
     return set_error_line(err_buf, err_len, line_no, "malformed header");
-  sec[sec_end] = '\0';
-  sec += sec_start;
 
   unsigned int seconds = 0;
 
-  rc = parse_seconds_value(sec, line_no, err_buf, err_len, &seconds);
+  rc = parse_seconds_value(sec + sec_start,
+      sec_end - sec_start,
+      line_no,
+      err_buf,
+      err_len,
+      &seconds);
   if (rc != 0)
     return -1;
-  size_t group_index = session->group_count;
-  size_t item_count = session->item_count;
-  const char* buffer = session->buffer;
+  size_t group_index = t->group_count;
+  size_t item_count = t->item_count;
 
-  if (group_index >= MAX_GROUPS)
+  if (group_index >= t->group_cap)
     return set_error_line(err_buf, err_len, line_no, "too many groups");
 
-  struct Group* group = &session->groups[group_index];
-  size_t name_length = strlen(name);
+  struct Group* group = &t->groups[group_index];
+  size_t name_length = name_end - name_start;
 
   if (name_length > MAX_LINE_LEN)
     return set_error_line(err_buf, err_len, line_no, "group name too long");
 
-  size_t name_offset = (size_t)(name - buffer);
-
-  group->name_offset = (u32)name_offset;
+  group->name_offset = (u64)(line_start + 1 + name_start);
   group->name_length = (u32)name_length;
   group->seconds = (u32)seconds;
   group->item_start = (u32)item_count;
   group->item_count = 0;
-  session->group_count++;
+  group->expand = 0;
+  group->flags = flags;
+  t->group_count++;
   return 0;
 }
 
-static int parse_item_line(struct Session* session,
+static int parse_item_line(struct parse_tables* t,
     const struct parse_state* state,
+    const char* line,
     size_t line_start,
     size_t line_len,
     char* err_buf,
     size_t err_len) {
-  if (!validate_ptr(session))
+  if (!validate_ptr(t))
     return -1;
   if (!validate_ptr(state))
     return -1;
+  if (!validate_ptr(line))
+    return -1;
 
   if (!state->has_group)
     return set_error_line(
         err_buf, err_len, state->line_no, "item before any group header");
-  if (session->item_count >= MAX_ITEMS_TOTAL)
+  if (t->item_count >= t->item_cap)
     return set_error_line(err_buf, err_len, state->line_no, "too many items");
   size_t group_index = state->current_group;
 
-  if (!assert_ok(group_index < session->group_count))
+  if (!assert_ok(group_index < t->group_count))
     return -1;
-  struct Group* group = &session->groups[group_index];
+  struct Group* group = &t->groups[group_index];
 
   if (group->item_count >= MAX_ITEMS_PER_GROUP)
     return set_error_line(
         err_buf, err_len, state->line_no, "too many items in group");
+  if (!assert_ok((u64)line_start >= group->name_offset))
+    return -1;
+
+  u64 offset = (u64)line_start - group->name_offset;
+
+  if (offset > MAX_GROUP_BYTES)
+    return set_error_line(err_buf, err_len, state->line_no, "group too large");
+
+  u32 expand = 0;
 
-  size_t item_index = session->item_count;
-  struct Item* item = &session->items[item_index];
+  if (group->flags & GROUP_GENERATOR) {
+    struct Generator gen;
+    const char* why = NULL;
 
-  item->offset = (u32)line_start;
-  item->length = (u32)line_len;
-  session->item_count++;
+    if (group->item_count > 0)
+      return set_error_line(err_buf,
+          err_len,
+          state->line_no,
+          "generator must be the only line in its group");
+    if (gen_parse(&gen, line, line_len, &why) != 0)
+      return set_error_line(err_buf, err_len, state->line_no, why);
+    expand = (u32)gen.total;
+  }
+
+  size_t item_index = t->item_count;
+
+  t->items[item_index].offset = (u32)offset;
+  group->expand = expand;
+  t->item_count++;
   group->item_count++;
   return 0;
 }
 
-static int handle_line(struct Session* session,
+static int handle_line(struct parse_tables* t,
     struct parse_state* state,
-    char* line,
-    size_t line_len,
-    size_t line_start,
+    const char* line,
+    const struct ScanLine* sl,
     char* err_buf,
     size_t err_len) {
-  if (!validate_ptr(session))
+  if (!validate_ptr(t))
     return -1;
   if (!validate_ptr(state))
     return -1;
   if (!validate_ptr(line))
     return -1;
+  if (!validate_ptr(sl))
+    return -1;
+
+  size_t line_len = sl->len;
+  size_t line_start = sl->start;
 
-  if (is_blank_or_comment(line, line_len))
+  /* Blank or whole-line comment. */
+  if (sl->first >= line_len || line[sl->first] == '#')
     return 0;
   if (line[0] == '[') {
-    if (state->has_group) {
+    if (state->has_group && !state->carry_open) {
       size_t group_index = state->current_group;
 
-      if (!assert_ok(group_index < session->group_count))
+      if (!assert_ok(group_index < t->group_count))
         return -1;
-      const struct Group* group = &session->groups[group_index];
+      const struct Group* group = &t->groups[group_index];
       if (group->item_count == 0)
         return set_error_line(
             err_buf, err_len, state->line_no, "previous group has no items");
     }
     int rc = parse_header_line(
-        session, line, line_len, state->line_no, err_buf, err_len);
+        t, line, line_len, line_start, state->line_no, err_buf, err_len);
     if (rc != 0)
       return -1;
-    size_t group_count = session->group_count;
+    size_t group_count = t->group_count;
 
     if (!assert_ok(group_count > 0))
       return -1;
     state->current_group = group_count - 1;
     state->has_group = 1;
+    state->carry_open = 0;
     return 0;
   }
   return parse_item_line(
-      session, state, line_start, line_len, err_buf, err_len);
+      t, state, line, line_start, line_len, err_buf, err_len);
 }
 
-static int parse_session_buffer(
-    struct Session* session, char* err_buf, size_t err_len) {
-  if (!validate_ptr(session))
+static void parse_state_init(struct parse_state* state) {
+  state->line_no = 1;
+  state->has_group = 0;
+  state->current_group = 0;
+  state->carry_open = 0;
+}
+
+/* Parses the lines of buf[start, start + len); offsets stay absolute.
+ * With `open_end`, bytes after the last '\n' are left for a later call
+ * and `*consumed` tells how far parsing got.
+ */
+static int parse_range(struct parse_tables* t,
+    struct parse_state* state,
+    const char* buf,
+    size_t start,
+    size_t len,
+    int open_end,
+    size_t* consumed,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(t))
     return -1;
-  if (!validate_ptr(err_buf))
+  if (!validate_ptr(state))
     return -1;
-  if (!validate_ok(err_len > 0))
+  if (!validate_ptr(buf))
+    return -1;
+  if (!validate_ptr(consumed))
     return -1;
 
-  struct parse_state state;
-
-  state.line_no = 1;
-  state.has_group = 0;
-  state.current_group = 0;
+  struct Scanner sc;
+  struct ScanLine lines[SCAN_BATCH_LINES];
 
-  size_t buf_len = session->buffer_len;
-  char* buf = session->buffer;
-  size_t line_start = 0;
+  *consumed = 0;
+  if (scan_start(&sc, buf + start, len) != 0)
+    return set_error(err_buf, err_len, "failed to scan file");
+  sc.open_end = open_end;
 
-  for (size_t i = 0; i <= MAX_FILE_BYTES; i++) {
-    if (i == buf_len || buf[i] == '\n') {
-      size_t line_len = i - line_start;
+  for (u64 batch = 0; batch <= MAX_DECK_BYTES; batch++) {
+    size_t n = scan_lines(&sc, lines, SCAN_BATCH_LINES);
 
-      if (line_len > 0 && buf[line_start + line_len - 1] == '\r')
-        line_len--;
-      if (line_len > MAX_LINE_LEN)
-        return set_error_line(err_buf, err_len, state.line_no, "line too long");
-      char* line = &buf[line_start];
+    if (n == 0)
+      break;
+    for (size_t k = 0; k < SCAN_BATCH_LINES; k++) {
+      if (k >= n)
+        break;
+      struct ScanLine* sl = &lines[k];
 
-      line[line_len] = '\0';
-      int rc = handle_line(
-          session, &state, line, line_len, line_start, err_buf, err_len);
+      if (sl->len > MAX_LINE_LEN)
+        return set_error_line(
+            err_buf, err_len, state->line_no, "line too long");
+      if (sc.bad < sl->start + sl->len)
+        return set_error_line(
+            err_buf, err_len, state->line_no, "invalid UTF-8");
+      sl->start += start;
+      int rc = handle_line(t, state, &buf[sl->start], sl, err_buf, err_len);
       if (rc != 0)
         return -1;
-      line_start = i + 1;
-      state.line_no++;
-      if (i == buf_len)
-        break;
+      state->line_no++;
     }
   }
+  *consumed = sc.pos;
+  return 0;
+}
+
+static int parse_finish(const struct parse_tables* t,
+    const struct parse_state* state,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(t))
+    return -1;
+  if (!validate_ptr(state))
+    return -1;
 
-  if (session->group_count == 0)
+  if (t->group_count == 0)
     return set_error(err_buf, err_len, "no groups found");
-  if (state.has_group) {
-    size_t group_index = state.current_group;
+  if (state->has_group) {
+    size_t group_index = state->current_group;
 
-    if (!assert_ok(group_index < session->group_count))
+    if (!assert_ok(group_index < t->group_count))
       return -1;
-    const struct Group* group = &session->groups[group_index];
+    const struct Group* group = &t->groups[group_index];
     if (group->item_count == 0)
       return set_error_line(
-          err_buf, err_len, state.line_no, "last group has no items");
+          err_buf, err_len, state->line_no, "last group has no items");
   }
   return 0;
 }
 
-static int read_file_into_session(
-    const char* path, struct Session* session, char* err_buf, size_t err_len) {
-  if (!validate_ptr(path))
-    return -1;
+static void session_tables(struct Session* session, struct parse_tables* t) {
+  t->groups = session->groups;
+  t->group_count = 0;
+  t->group_cap = session->group_cap;
+  t->items = session->items;
+  t->item_count = 0;
+  t->item_cap = session->item_cap;
+}
+
+/* Table room for `bytes` of deck text: an item line takes at least 2
+ * bytes with its '\n', a group at least 8 (header and one item).
+ */
+static void table_caps(u64 bytes, size_t* groups, size_t* items) {
+  u64 item_cap = bytes / 2U + 1U;
+  u64 group_cap = bytes / 8U + 1U;
+
+  if (item_cap > MAX_ITEMS_TOTAL)
+    item_cap = MAX_ITEMS_TOTAL;
+  if (group_cap > MAX_GROUPS)
+    group_cap = MAX_GROUPS;
+  *groups = (size_t)group_cap;
+  *items = (size_t)item_cap;
+}
+
+static int reserve_tables(
+    struct Session* session, u64 bytes, char* err_buf, size_t err_len) {
+  size_t groups = 0;
+  size_t items = 0;
+
+  table_caps(bytes, &groups, &items);
+  if (session_reserve(session, groups, items) != 0)
+    return set_error(err_buf, err_len, "failed to reserve table memory");
+  return 0;
+}
+
+static int parse_session_buffer(
+    struct Session* session, char* err_buf, size_t err_len) {
   if (!validate_ptr(session))
     return -1;
   if (!validate_ptr(err_buf))
@@ -352,66 +506,1666 @@ static int read_file_into_session(
   if (!validate_ok(err_len > 0))
     return -1;
 
-  FILE* fp = fopen(path, "rb");
+  struct parse_state state;
+  struct parse_tables t;
+
+  parse_state_init(&state);
+  session_tables(session, &t);
+
+  size_t consumed = 0;
+  int rc = parse_range(&t,
+      &state,
+      session->text,
+      0,
+      session->text_len,
+      0,
+      &consumed,
+      err_buf,
+      err_len);
+
+  session->group_count = t.group_count;
+  session->item_count = t.item_count;
+  if (rc != 0)
+    return -1;
+  return parse_finish(&t, &state, err_buf, err_len);
+}
 
-  if (!fp) {
-    const char* err = strerror(errno);
+/* Lazy mode: startup only indexes header lines (lines whose first byte is
+ * '['); a group's items are parsed the first time it is selected. Line
+ * numbers are only needed for errors, so they are recounted from the start
+ * of the text on that path.
+ */
+static size_t line_number_at(const char* text, size_t offset) {
+  size_t line_no = 1;
+  size_t pos = 0;
+
+  for (u64 i = 0; i <= MAX_DECK_BYTES; i++) {
+    if (pos >= offset)
+      break;
+    const char* nl = memchr(text + pos, '\n', offset - pos);
 
-    if (!err)
-      err = "unknown error";
-    char msg[256];
-    int rc = snprintf(msg, sizeof(msg), "Failed to open '%s': %s", path, err);
-    if (rc < 0 || (size_t)rc >= sizeof(msg))
-      return set_error(err_buf, err_len, "failed to open file");
-    return set_error(err_buf, err_len, msg);
+    if (!nl)
+      break;
+    line_no++;
+    pos = (size_t)(nl - text) + 1;
   }
+  return line_no;
+}
+
+/* Describes the line at `start` as the scanner would and returns the
+ * offset of the next line.
+ */
+static size_t line_at(
+    const char* text, size_t len, size_t start, struct ScanLine* sl) {
+  size_t window = len - start;
+
+  if (window > (size_t)MAX_LINE_LEN + 2U)
+    window = (size_t)MAX_LINE_LEN + 2U;
+
+  const char* nl = memchr(text + start, '\n', window);
+  size_t end = nl ? (size_t)(nl - text) : start + window;
+
+  sl->start = start;
+  sl->len = end - start;
+  if (sl->len > 0 && text[end - 1] == '\r')
+    sl->len--;
+  sl->first = 0;
+  return nl ? end + 1 : end;
+}
+
+static int lazy_header(struct parse_tables* t,
+    const char* text,
+    size_t len,
+    size_t start,
+    size_t line_no,
+    size_t* next,
+    char* err_buf,
+    size_t err_len) {
+  struct ScanLine sl;
+
+  *next = line_at(text, len, start, &sl);
+  if (sl.len > MAX_LINE_LEN)
+    return set_error_line(err_buf, err_len, line_no, "line too long");
+  if (scan_utf8(scan_detect(), text + start, sl.len) != sl.len)
+    return set_error_line(err_buf, err_len, line_no, "invalid UTF-8");
+  return parse_header_line(
+      t, text + start, sl.len, start, line_no, err_buf, err_len);
+}
 
-  size_t nread = fread(session->buffer, 1, MAX_FILE_BYTES, fp);
+static int parse_session_lazy(
+    struct Session* session, char* err_buf, size_t err_len) {
+  struct parse_state state;
+  struct parse_tables t;
+  const char* text = session->text;
+  size_t len = session->text_len;
+  size_t pos = 0;
+  size_t consumed = 0;
+
+  parse_state_init(&state);
+  session_tables(session, &t);
+  for (u64 i = 0; i <= MAX_DECK_BYTES; i++) {
+    if (pos >= len)
+      break;
+    const char* hit = memchr(text + pos, '[', len - pos);
 
-  if (ferror(fp)) {
-    int crc = fclose(fp);
+    if (!hit)
+      break;
+    size_t start = (size_t)(hit - text);
+
+    pos = start + 1;
+    if (start > 0 && text[start - 1] != '\n')
+      continue;
+    /* Lines before the first header may only be blank or comments. */
+    if (t.group_count == 0 &&
+        parse_range(
+            &t, &state, text, 0, start, 0, &consumed, err_buf, err_len) != 0)
+      return -1;
+    if (lazy_header(&t, text, len, start, 0, &pos, err_buf, err_len) != 0) {
+      size_t line_no = line_number_at(text, start);
 
-    if (crc != 0)
-      return set_error(err_buf, err_len, "failed to close file");
-    return set_error(err_buf, err_len, "failed to read file");
+      (void)lazy_header(&t, text, len, start, line_no, &pos, err_buf, err_len);
+      return -1;
+    }
   }
-  int extra = fgetc(fp);
+  if (t.group_count == 0 &&
+      parse_range(&t, &state, text, 0, len, 0, &consumed, err_buf, err_len) !=
+          0)
+    return -1;
+  if (t.group_count == 0)
+    return set_error(err_buf, err_len, "no groups found");
+  session->group_count = t.group_count;
+  session->item_count = 0;
+  session->lazy = 1;
+  return 0;
+}
 
-  if (extra != EOF) {
-    int crc = fclose(fp);
+static size_t header_start(const struct Session* session, size_t group_index) {
+  size_t pos = (size_t)session->groups[group_index].name_offset;
 
-    if (crc != 0)
-      return set_error(err_buf, err_len, "failed to close file");
-    return set_error(err_buf, err_len, "file exceeds MAX_FILE_BYTES");
+  /* Only spaces separate the '[' from the trimmed name. */
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (pos == 0 || session->text[pos] == '[')
+      break;
+    pos--;
   }
-  if (fclose(fp) != 0)
-    return set_error(err_buf, err_len, "failed to close file");
+  return pos;
+}
+
+static int lazy_items(struct Session* session,
+    size_t group_index,
+    size_t line_no,
+    char* err_buf,
+    size_t err_len) {
+  struct parse_state state;
+  struct parse_tables t;
+  struct ScanLine sl;
+  struct Group* group = &session->groups[group_index];
+  size_t start = line_at(session->text,
+      session->text_len,
+      header_start(session, group_index),
+      &sl);
+  size_t end = session->text_len;
+  size_t consumed = 0;
+  int last = (group_index + 1 >= session->group_count);
+  /* A body that ends at the next header ends in '\n'; only the last one
+   * gets the trailing empty line the full parse sees after a final '\n'.
+   */
+  int lines = (start < end) || (end > 0 && session->text[end - 1] == '\n');
+
+  if (!last) {
+    end = header_start(session, group_index + 1);
+    lines = (start < end);
+  }
+  parse_state_init(&state);
+  state.line_no = line_no;
+  state.has_group = 1;
+  state.current_group = group_index;
+  session_tables(session, &t);
+  t.group_count = session->group_count;
+  t.item_count = session->item_count;
+  group->item_start = (u32)session->item_count;
+  group->item_count = 0;
+
+  /* The index guarantees no header lines in [start, end). */
+  if (lines &&
+      parse_range(&t,
+          &state,
+          session->text,
+          start,
+          end - start,
+          !last,
+          &consumed,
+          err_buf,
+          err_len) != 0)
+    return -1;
+  if (group->item_count == 0) {
+    const char* msg = !last ? "previous group has no items"
+        : "last group has no items";
+
+    return set_error_line(err_buf, err_len, state.line_no, msg);
+  }
+  session->item_count = t.item_count;
+  return 0;
+}
+
+int parse_group_items(struct Session* session,
+    size_t group_index,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!assert_ok(group_index < session->group_count))
+    return -1;
+  if (!session->lazy || session->groups[group_index].item_count > 0)
+    return 0;
+
+  size_t body_end = (group_index + 1 < session->group_count)
+      ? header_start(session, group_index + 1)
+      : session->text_len;
+  size_t most = (body_end - header_start(session, group_index)) / 2U + 1U;
+
+  /* Items of groups no longer in use are dropped when the store runs low;
+   * those groups are parsed again if they come back.
+   */
+  if (session->item_cap - session->item_count < most) {
+    for (size_t i = 0; i < MAX_GROUPS; i++) {
+      if (i >= session->group_count)
+        break;
+      session->groups[i].item_count = 0;
+    }
+    session->item_count = 0;
+  }
+  if (lazy_items(session, group_index, 0, err_buf, err_len) == 0)
+    return 0;
+
+  size_t line_no = line_number_at(session->text,
+      header_start(session, group_index));
+
+  /* Start on the line after the header, as the eager parse would. */
+  (void)lazy_items(session, group_index, line_no + 1, err_buf, err_len);
+  session->groups[group_index].item_count = 0;
+  return -1;
+}
+
+struct chunk_plan {
+  size_t start;
+  size_t len;
+  size_t group_base;
+  size_t group_cap;
+  size_t item_base;
+  size_t item_cap;
+};
+
+/* Written by each worker into the shared scratch mapping. */
+struct chunk_result {
+  int status;
+  size_t group_count;
+  size_t item_count;
+};
+
+struct chunk_scratch {
+  void* addr;
+  size_t len;
+  struct chunk_result* results;
+  struct Group* groups;
+  struct Item* items;
+};
+
+static size_t min_size(size_t a, size_t b) {
+  return (a < b) ? a : b;
+}
+
+/* Splits the text into at most `jobs` chunks that end just past a '\n'. */
+static size_t plan_chunks(const struct Session* session,
+    unsigned int jobs,
+    struct chunk_plan* plans) {
+  size_t len = session->text_len;
+  const char* buf = session->text;
+  size_t count = 0;
+  size_t start = 0;
+
+  for (size_t k = 0; k < MAX_PARSE_JOBS; k++) {
+    if (k >= jobs || start >= len)
+      break;
+    size_t end = len;
+
+    if (k + 1 < jobs) {
+      size_t target = start + (len - start) / (jobs - k);
+      const char* nl = memchr(buf + target, '\n', len - target);
+
+      if (nl)
+        end = (size_t)(nl - buf) + 1U;
+    }
+    struct chunk_plan* plan = &plans[count];
+
+    plan->start = start;
+    plan->len = end - start;
+    /* An item takes at least 2 bytes, a header at least 6; group 0 of a
+     * later chunk is the carry-over of the group open at its start.
+     */
+    plan->item_cap = min_size(MAX_ITEMS_TOTAL, plan->len / 2U + 1U);
+    plan->group_cap = min_size(MAX_GROUPS + 1U, plan->len / 6U + 2U);
+    count++;
+    start = end;
+  }
+  return count;
+}
+
+static int scratch_map(
+    struct chunk_scratch* scratch, struct chunk_plan* plans, size_t count) {
+  size_t groups = 0;
+  size_t items = 0;
 
-  session->buffer_len = nread;
-  session->buffer[nread] = '\0';
+  for (size_t k = 0; k < MAX_PARSE_JOBS; k++) {
+    if (k >= count)
+      break;
+    plans[k].group_base = groups;
+    plans[k].item_base = items;
+    groups += plans[k].group_cap;
+    items += plans[k].item_cap;
+  }
+
+  size_t res_bytes = sizeof(struct chunk_result) * MAX_PARSE_JOBS;
+  size_t group_bytes = sizeof(struct Group) * groups;
+  size_t item_bytes = sizeof(struct Item) * items;
+  size_t len = res_bytes + group_bytes + item_bytes;
+  void* addr = mmap(NULL,
+      len,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+      -1,
+      0);
+
+  if (addr == MAP_FAILED)
+    return -1;
+  scratch->addr = addr;
+  scratch->len = len;
+  scratch->results = (struct chunk_result*)addr;
+  scratch->groups = (struct Group*)(void*)((char*)addr + res_bytes);
+  scratch->items =
+      (struct Item*)(void*)((char*)addr + res_bytes + group_bytes);
   return 0;
 }
 
-int parse_session_file(
-    const char* path, struct Session* session, char* err_buf, size_t err_len) {
-  if (!validate_ptr(path))
+static int parse_chunk(const struct Session* session,
+    const struct chunk_scratch* scratch,
+    const struct chunk_plan* plan,
+    size_t index) {
+  struct chunk_result* res = &scratch->results[index];
+  struct parse_tables t;
+  struct parse_state state;
+  char err_buf[128];
+
+  t.groups = scratch->groups + plan->group_base;
+  t.group_count = 0;
+  t.group_cap = plan->group_cap;
+  t.items = scratch->items + plan->item_base;
+  t.item_count = 0;
+  t.item_cap = plan->item_cap;
+  parse_state_init(&state);
+  if (index > 0) {
+    struct Group* carry = &t.groups[0];
+
+    /* Its items are relative to the chunk until they are merged. */
+    carry->name_offset = (u64)plan->start;
+    carry->name_length = 0;
+    carry->seconds = 0;
+    carry->item_start = 0;
+    carry->item_count = 0;
+    carry->expand = 0;
+    carry->flags = 0;
+    t.group_count = 1;
+    state.has_group = 1;
+    state.carry_open = 1;
+  }
+
+  /* Chunks before the last one end in '\n'; nothing follows it. */
+  size_t consumed = 0;
+  int open_end = (plan->start + plan->len < session->text_len);
+  int rc = parse_range(&t,
+      &state,
+      session->text,
+      plan->start,
+      plan->len,
+      open_end,
+      &consumed,
+      err_buf,
+      sizeof(err_buf));
+
+  res->group_count = t.group_count;
+  res->item_count = t.item_count;
+  res->status = (rc == 0) ? 0 : -1;
+  return res->status;
+}
+
+static int wait_worker(pid_t pid) {
+  int status = 0;
+
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    pid_t got = waitpid(pid, &status, 0);
+
+    if (got == pid)
+      return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+    if (got < 0 && errno != EINTR)
+      return -1;
+  }
+  return -1;
+}
+
+/* Runs chunk 0 here and the rest in forked workers; all of them write
+ * into the shared scratch mapping.
+ */
+static int run_chunks(const struct Session* session,
+    const struct chunk_scratch* scratch,
+    const struct chunk_plan* plans,
+    size_t count) {
+  pid_t pids[MAX_PARSE_JOBS];
+  int ok = 1;
+
+  for (size_t k = 1; k < MAX_PARSE_JOBS; k++) {
+    if (k >= count)
+      break;
+    pids[k] = fork();
+    if (pids[k] == 0) {
+      int rc = parse_chunk(session, scratch, &plans[k], k);
+
+      _exit((rc == 0) ? 0 : 1);
+    }
+  }
+  if (parse_chunk(session, scratch, &plans[0], 0) != 0)
+    ok = 0;
+  for (size_t k = 1; k < MAX_PARSE_JOBS; k++) {
+    if (k >= count)
+      break;
+    int rc = 0;
+
+    if (pids[k] > 0)
+      rc = wait_worker(pids[k]);
+    else
+      rc = parse_chunk(session, scratch, &plans[k], k);
+    if (rc != 0)
+      ok = 0;
+  }
+  return ok ? 0 : -1;
+}
+
+/* Concatenates chunk tables in order. Items already sit in file order,
+ * so a chunk's carry-over items extend the group left open by the chunks
+ * before it, once rebased from the chunk start to that group. Any rule
+ * violation returns -1; the caller then re-parses serially to report it
+ * with the exact line.
+ */
+static int merge_chunks(struct Session* session,
+    const struct chunk_scratch* scratch,
+    const struct chunk_plan* plans,
+    size_t count) {
+  size_t group_count = 0;
+  size_t item_count = 0;
+  int has_open = 0;
+
+  for (size_t k = 0; k < MAX_PARSE_JOBS; k++) {
+    if (k >= count)
+      break;
+    const struct chunk_result* res = &scratch->results[k];
+    const struct Group* groups = scratch->groups + plans[k].group_base;
+    const struct Item* items = scratch->items + plans[k].item_base;
+    size_t first = 0;
+    size_t carried = 0;
+    u64 shift = 0;
+
+    if (res->status != 0)
+      return -1;
+    if (k > 0) {
+      carried = groups[0].item_count;
+      if (carried > 0) {
+        if (!has_open)
+          return -1;
+        struct Group* open = &session->groups[group_count - 1];
+
+        if ((size_t)open->item_count + carried > MAX_ITEMS_PER_GROUP)
+          return -1;
+        /* Chunks other than the header's cannot tell a generator group;
+         * its line is checked serially.
+         */
+        if (open->flags & GROUP_GENERATOR)
+          return -1;
+        shift = (u64)plans[k].start - open->name_offset;
+        if (shift + (u64)items[carried - 1U].offset > MAX_GROUP_BYTES)
+          return -1;
+        open->item_count += (u32)carried;
+      }
+      first = 1;
+    }
+    if (item_count + res->item_count > session->item_cap)
+      return -1;
+    for (size_t g = first; g < MAX_GROUPS + 1U; g++) {
+      if (g >= res->group_count)
+        break;
+      if (has_open && session->groups[group_count - 1].item_count == 0)
+        return -1;
+      if (group_count >= session->group_cap)
+        return -1;
+      struct Group* dst = &session->groups[group_count];
+
+      *dst = groups[g];
+      dst->item_start += (u32)item_count;
+      group_count++;
+      has_open = 1;
+    }
+    memcpy(&session->items[item_count],
+        items,
+        sizeof(struct Item) * res->item_count);
+    for (size_t i = 0; i < MAX_ITEMS_TOTAL; i++) {
+      if (i >= carried)
+        break;
+      session->items[item_count + i].offset += (u32)shift;
+    }
+    item_count += res->item_count;
+  }
+  if (group_count == 0)
     return -1;
-  if (!validate_ptr(session))
+  if (session->groups[group_count - 1].item_count == 0)
     return -1;
-  if (!validate_ptr(err_buf))
+  session->group_count = group_count;
+  session->item_count = item_count;
+  return 0;
+}
+
+static int parse_session_parallel(struct Session* session, unsigned int jobs) {
+  struct chunk_plan plans[MAX_PARSE_JOBS];
+  struct chunk_scratch scratch;
+  size_t count = plan_chunks(session, jobs, plans);
+
+  if (count < 2)
     return -1;
-  if (!validate_ok(err_len > 0))
+  if (scratch_map(&scratch, plans, count) != 0)
     return -1;
 
-  int rc = session_init(session);
+  int rc = run_chunks(session, &scratch, plans, count);
 
-  if (rc != 0)
-    return set_error(err_buf, err_len, "failed to init session");
-  rc = read_file_into_session(path, session, err_buf, err_len);
-  if (rc != 0)
+  if (rc == 0)
+    rc = merge_chunks(session, &scratch, plans, count);
+  if (munmap(scratch.addr, scratch.len) != 0)
+    rc = -1;
+  if (rc != 0) {
+    session->group_count = 0;
+    session->item_count = 0;
+  }
+  return rc;
+}
+
+static int parse_session_text(struct Session* session,
+    const struct ParseOptions* opts,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(session))
     return -1;
-  rc = parse_session_buffer(session, err_buf, err_len);
-  if (rc != 0)
+  if (!validate_ptr(opts))
+    return -1;
+
+  if (opts->lazy)
+    return parse_session_lazy(session, err_buf, err_len);
+
+  unsigned int jobs = opts->jobs;
+  size_t min_len = (size_t)PARSE_MIN_CHUNK_BYTES * 2U;
+
+  if (jobs > MAX_PARSE_JOBS)
+    jobs = MAX_PARSE_JOBS;
+  if (jobs > 1 && session->text_len >= min_len) {
+    size_t by_size = session->text_len / PARSE_MIN_CHUNK_BYTES;
+
+    if (by_size < jobs)
+      jobs = (unsigned int)by_size;
+    /* On failure the serial pass produces the exact error line. */
+    if (parse_session_parallel(session, jobs) == 0)
+      return 0;
+  }
+  return parse_session_buffer(session, err_buf, err_len);
+}
+
+static int set_errno_error(
+    char* err_buf, size_t err_len, const char* what, const char* path) {
+  const char* err = strerror(errno);
+
+  if (!err)
+    err = "unknown error";
+  char msg[256];
+  int rc = snprintf(msg, sizeof(msg), "Failed to %s '%s': %s", what, path, err);
+
+  if (rc < 0 || (size_t)rc >= sizeof(msg))
+    return set_error(err_buf, err_len, "failed to open file");
+  return set_error(err_buf, err_len, msg);
+}
+
+static u64 now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+/* Streamed text goes to one reserved range of `len` bytes; shared when a
+ * reader process fills it. Pages are only committed as text arrives.
+ */
+static void* reserve_text(size_t len, int shared) {
+  int flags = (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS |
+      MAP_NORESERVE;
+  void* addr = mmap(NULL,
+      len,
+      PROT_READ | PROT_WRITE,
+      flags,
+      -1,
+      0);
+
+  return (addr == MAP_FAILED) ? NULL : addr;
+}
+
+static int stream_reserve(struct Session* session, size_t len, int shared) {
+  void* addr = reserve_text(len, shared);
+
+  if (!addr)
     return -1;
+  session->map_addr = addr;
+  session->map_len = len;
+  session->text = (const char*)addr;
+  session->text_len = 0;
+  return 0;
+}
+
+struct stream {
+  struct parse_tables t;
+  struct parse_state state;
+  char* base;
+  size_t cap;
+  size_t parsed;
+};
+
+enum stream_status {
+  STREAM_MORE = 0,
+  STREAM_EOF = 1,
+  STREAM_READ_ERROR = 2,
+  STREAM_FULL = 3,
+};
+
+/* Sent by the reader process after each block: text is valid up to `len`.
+ */
+struct stream_token {
+  u64 len;
+  u64 read_ns;
+  u32 status;
+  u32 blocks;
+};
+
+static void stream_begin(struct stream* st, struct Session* session) {
+  parse_state_init(&st->state);
+  session_tables(session, &st->t);
+  st->base = (char*)session->map_addr;
+  st->cap = session->map_len;
+  st->parsed = 0;
+}
+
+/* Tables of streamed input grow with its text: before `len` bytes are
+ * parsed they get room for what that much text can hold, at least
+ * doubling so a long stream is copied a few times only.
+ */
+static int stream_tables(struct stream* st,
+    struct Session* session,
+    size_t len,
+    char* err_buf,
+    size_t err_len) {
+  size_t groups = 0;
+  size_t items = 0;
+
+  table_caps((u64)len, &groups, &items);
+  if (groups <= st->t.group_cap && items <= st->t.item_cap)
+    return 0;
+  if (groups < st->t.group_cap * 2U)
+    groups = min_size(st->t.group_cap * 2U, MAX_GROUPS);
+  if (items < st->t.item_cap * 2U)
+    items = min_size(st->t.item_cap * 2U, MAX_ITEMS_TOTAL);
+  session->group_count = st->t.group_count;
+  session->item_count = st->t.item_count;
+  if (session_grow(session, groups, items) != 0)
+    return set_error(err_buf, err_len, "failed to reserve table memory");
+  st->t.groups = session->groups;
+  st->t.group_cap = session->group_cap;
+  st->t.items = session->items;
+  st->t.item_cap = session->item_cap;
+  return 0;
+}
+
+/* Parses the complete lines that text up to `len` adds. A line cut by a
+ * block boundary stays in place and is parsed once its newline arrives.
+ */
+static int stream_feed(struct stream* st,
+    struct Session* session,
+    size_t len,
+    char* err_buf,
+    size_t err_len) {
+  if (session->text_len == 0 && image_detect(st->base, len))
+    return set_error(err_buf, err_len, "compiled decks must be opened by path");
+  if (stream_tables(st, session, len, err_buf, err_len) != 0)
+    return -1;
+  session->text_len = len;
+
+  u64 t0 = now_ns();
+  size_t consumed = 0;
+  int rc = parse_range(&st->t,
+      &st->state,
+      st->base,
+      st->parsed,
+      len - st->parsed,
+      1,
+      &consumed,
+      err_buf,
+      err_len);
+
+  session->ingest.parse_ns += now_ns() - t0;
+  if (rc != 0)
+    return -1;
+  st->parsed += consumed;
+  /* Room for one '\r' before the '\n' that has not arrived yet. */
+  if (len - st->parsed > (size_t)MAX_LINE_LEN + 1U)
+    return set_error_line(
+        err_buf, err_len, st->state.line_no, "line too long");
+  return 0;
+}
+
+static int stream_end(struct stream* st,
+    struct Session* session,
+    int rc,
+    char* err_buf,
+    size_t err_len) {
+  if (rc == 0) {
+    u64 t0 = now_ns();
+    size_t consumed = 0;
+
+    rc = parse_range(&st->t,
+        &st->state,
+        st->base,
+        st->parsed,
+        session->text_len - st->parsed,
+        0,
+        &consumed,
+        err_buf,
+        err_len);
+    session->ingest.parse_ns += now_ns() - t0;
+  }
+  session->group_count = st->t.group_count;
+  session->item_count = st->t.item_count;
+  if (rc != 0)
+    return -1;
+  return parse_finish(&st->t, &st->state, err_buf, err_len);
+}
+
+static int stream_status_error(
+    u32 status, char* err_buf, size_t err_len) {
+  if (status == STREAM_FULL)
+    return set_error(
+        err_buf, err_len, "input exceeds its reserved size");
+  return set_error(err_buf, err_len, "failed to read input");
+}
+
+/* Reads one block at `len`; returns bytes read or the stream_status that
+ * ended the input as a negative value.
+ */
+static ssize_t stream_read_block(int fd, char* base, size_t cap, size_t len) {
+  if (len >= cap)
+    return -(ssize_t)STREAM_FULL;
+
+  size_t want = min_size(cap - len, STREAM_BLOCK_BYTES);
+
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    ssize_t n = read(fd, base + len, want);
+
+    if (n >= 0)
+      return (n == 0) ? -(ssize_t)STREAM_EOF : n;
+    if (errno != EINTR)
+      break;
+  }
+  return -(ssize_t)STREAM_READ_ERROR;
+}
+
+static int stream_direct(
+    int fd, struct Session* session, char* err_buf, size_t err_len) {
+  struct stream st;
+  size_t len = 0;
+  int rc = 0;
+
+  stream_begin(&st, session);
+  for (u64 i = 0; i <= MAX_DECK_BYTES / STREAM_BLOCK_BYTES; i++) {
+    u64 t0 = now_ns();
+    ssize_t n = stream_read_block(fd, st.base, st.cap, len);
+
+    session->ingest.read_ns += now_ns() - t0;
+    if (n < 0) {
+      if (n != -(ssize_t)STREAM_EOF)
+        rc = stream_status_error((u32)-n, err_buf, err_len);
+      break;
+    }
+    len += (size_t)n;
+    session->ingest.blocks++;
+    rc = stream_feed(&st, session, len, err_buf, err_len);
+    if (rc != 0)
+      break;
+  }
+  return stream_end(&st, session, rc, err_buf, err_len);
+}
+
+static int write_token(int fd, const struct stream_token* tok) {
+  const char* ptr = (const char*)tok;
+  size_t left = sizeof(*tok);
+
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (left == 0)
+      break;
+    ssize_t n = write(fd, ptr, left);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    ptr += (size_t)n;
+    left -= (size_t)n;
+  }
+  return (left == 0) ? 0 : -1;
+}
+
+static int read_token(int fd, struct stream_token* tok) {
+  char* ptr = (char*)tok;
+  size_t left = sizeof(*tok);
+
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (left == 0)
+      break;
+    ssize_t n = read(fd, ptr, left);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    ptr += (size_t)n;
+    left -= (size_t)n;
+  }
+  return (left == 0) ? 0 : -1;
+}
+
+/* Reader process: fills the shared range and reports progress per block.
+ */
+static void stream_reader(int fd, char* base, size_t cap, int out_fd) {
+  struct stream_token tok;
+
+  tok.len = 0;
+  tok.read_ns = 0;
+  tok.status = STREAM_MORE;
+  tok.blocks = 0;
+  for (u64 i = 0; i <= MAX_DECK_BYTES / STREAM_BLOCK_BYTES; i++) {
+    u64 t0 = now_ns();
+    ssize_t n = stream_read_block(fd, base, cap, (size_t)tok.len);
+
+    tok.read_ns += now_ns() - t0;
+    if (n < 0) {
+      tok.status = (u32)-n;
+      break;
+    }
+    tok.len += (u64)n;
+    tok.blocks++;
+    if (write_token(out_fd, &tok) != 0)
+      return;
+  }
+  if (tok.status == STREAM_MORE)
+    tok.status = STREAM_READ_ERROR;
+  (void)write_token(out_fd, &tok);
+}
+
+/* Pipelined ingest: a forked reader reads block n+1 while this process
+ * parses block n. The reader runs ahead until the progress pipe fills.
+ */
+static int stream_pipelined(
+    int fd, struct Session* session, char* err_buf, size_t err_len) {
+  int fds[2];
+
+  if (pipe(fds) != 0)
+    return set_error(err_buf, err_len, "failed to create reader pipe");
+
+  struct stream st;
+
+  stream_begin(&st, session);
+
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+    return set_error(err_buf, err_len, "failed to start reader");
+  }
+  if (pid == 0) {
+    (void)close(fds[0]);
+    stream_reader(fd, st.base, st.cap, fds[1]);
+    _exit(0);
+  }
+  (void)close(fds[1]);
+  session->ingest.pipelined = 1;
+
+  int rc = 0;
+  struct stream_token tok;
+
+  for (u64 i = 0; i <= MAX_DECK_BYTES / STREAM_BLOCK_BYTES + 1U; i++) {
+    u64 t0 = now_ns();
+    int trc = read_token(fds[0], &tok);
+
+    session->ingest.wait_ns += now_ns() - t0;
+    if (trc != 0) {
+      rc = set_error(err_buf, err_len, "reader exited early");
+      break;
+    }
+    session->ingest.read_ns = tok.read_ns;
+    session->ingest.blocks = tok.blocks;
+    if ((size_t)tok.len > session->text_len) {
+      rc = stream_feed(&st, session, (size_t)tok.len, err_buf, err_len);
+      if (rc != 0)
+        break;
+    }
+    if (tok.status == STREAM_EOF)
+      break;
+    if (tok.status != STREAM_MORE) {
+      rc = stream_status_error(tok.status, err_buf, err_len);
+      break;
+    }
+  }
+  (void)close(fds[0]);
+  if (rc != 0)
+    (void)kill(pid, SIGTERM);
+  if (wait_worker(pid) != 0 && rc == 0)
+    rc = set_error(err_buf, err_len, "reader failed");
+  return stream_end(&st, session, rc, err_buf, err_len);
+}
+
+/* Second text range of a watched deck, which a reload reads into. */
+static int reserve_spare(
+    struct Session* session, size_t len, char* err_buf, size_t err_len) {
+  if (!assert_ok(session->spare_addr == NULL))
+    return -1;
+
+  session->spare_addr = reserve_text(len, 0);
+  if (!session->spare_addr)
+    return set_error(err_buf, err_len, "failed to reserve input memory");
+  session->spare_len = len;
+  return 0;
+}
+
+static int stream_fd_into_session(int fd,
+    size_t reserve,
+    int pipelined,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ok(fd >= 0))
+    return -1;
+  if (!validate_ok(reserve >= STREAM_BLOCK_BYTES))
+    return -1;
+  if (!validate_ptr(session))
+    return -1;
+
+  if (stream_reserve(session, reserve, pipelined) != 0)
+    return set_error(err_buf, err_len, "failed to reserve input memory");
+  if (pipelined)
+    return stream_pipelined(fd, session, err_buf, err_len);
+  return stream_direct(fd, session, err_buf, err_len);
+}
+
+static int map_fd_into_session(int fd,
+    const struct stat* st,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ok(fd >= 0))
+    return -1;
+  if (!validate_ptr(st))
+    return -1;
+  if (!validate_ptr(session))
+    return -1;
+
+  u64 size = (u64)st->st_size;
+
+  if (size > MAX_DECK_BYTES || size > (u64)SIZE_MAX)
+    return set_error(err_buf, err_len, "file exceeds MAX_DECK_BYTES");
+
+  void* addr = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (addr == MAP_FAILED)
+    return set_error(err_buf, err_len, "failed to map file");
+  (void)posix_madvise(addr, (size_t)size, POSIX_MADV_SEQUENTIAL);
+
+  session->map_addr = addr;
+  session->map_len = (size_t)size;
+  session->text = (const char*)addr;
+  session->text_len = (size_t)size;
+  return 0;
+}
+
+static void set_deck_id(struct Session* session, const struct stat* st) {
+  struct DeckId* id = &session->deck_id;
+
+  id->dev = (u64)st->st_dev;
+  id->ino = (u64)st->st_ino;
+  id->size = (u64)st->st_size;
+  id->mtime_ns =
+      (u64)st->st_mtim.tv_sec * 1000000000ULL + (u64)st->st_mtim.tv_nsec;
+  id->ctime_ns =
+      (u64)st->st_ctim.tv_sec * 1000000000ULL + (u64)st->st_ctim.tv_nsec;
+  session->has_deck_id = 1;
+}
+
+static int fd_is_image(int fd) {
+  char head[256];
+  ssize_t n = pread(fd, head, sizeof(head), 0);
+
+  if (n <= 0)
+    return 0;
+  return image_detect(head, (size_t)n);
+}
+
+static int elapsed_since(const struct timespec* t0, u64* out_ns) {
+  struct timespec t1;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &t1) != 0)
+    return -1;
+  *out_ns = (u64)(t1.tv_sec - t0->tv_sec) * 1000000000ULL + (u64)t1.tv_nsec -
+      (u64)t0->tv_nsec;
+  return 0;
+}
+
+/* Regular files are mapped read-only and parsed in place (or, for a
+ * compiled deck, used as-is); anything else (pipes, terminals, an empty
+ * file that cannot be mapped) is streamed.
+ */
+static int load_and_parse(int fd,
+    const char* path,
+    const struct ParseOptions* opts,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len) {
+  struct stat st;
+  struct timespec t0;
+
+  if (fstat(fd, &st) != 0)
+    return set_errno_error(err_buf, err_len, "stat", path);
+
+  int mapped = S_ISREG(st.st_mode) && st.st_size > 0;
+  int rc = 0;
+
+  /* Pipelining and watching read regular text files too (watching needs
+   * a private copy to diff against); images are always mapped.
+   */
+  if (mapped && opts->watch && fd_is_image(fd))
+    return set_error(err_buf, err_len, "compiled decks cannot be watched");
+  if (mapped && (opts->pipeline || opts->watch) && !fd_is_image(fd))
+    mapped = 0;
+
+  if (mapped) {
+    rc = map_fd_into_session(fd, &st, session, err_buf, err_len);
+    if (rc != 0)
+      return -1;
+  }
+  if (clock_gettime(CLOCK_MONOTONIC, &t0) != 0)
+    return set_error(err_buf, err_len, "failed to read clock");
+  if (mapped && image_detect(session->map_addr, session->map_len))
+    rc = image_attach(session, err_buf, err_len);
+  else if (mapped) {
+    set_deck_id(session, &st);
+    if (!opts->cache || cache_load(session, path) != 0) {
+      rc = reserve_tables(session, session->text_len, err_buf, err_len);
+      if (rc == 0)
+        rc = parse_session_text(session, opts, err_buf, err_len);
+    }
+  } else {
+    u64 bytes = STREAM_RESERVE_BYTES;
+    u64 table_bytes = STREAM_BLOCK_BYTES;
+    int sized = S_ISREG(st.st_mode) && st.st_size > 0;
+
+    if (sized && (u64)st.st_size > (MAX_DECK_BYTES - STREAM_BLOCK_BYTES) / 2U)
+      return set_error(err_buf, err_len, "file exceeds MAX_DECK_BYTES");
+    /* A regular file gets its size and a block of slack for a write that
+     * lands while it is read. A watched deck gets text (twice: the reload
+     * spare too) and tables for twice its size and a block, all reserved
+     * here; a reload past that is an error that keeps the previous
+     * version.
+     */
+    if (sized)
+      bytes = (u64)st.st_size + STREAM_BLOCK_BYTES;
+    if (sized && opts->watch)
+      bytes = (u64)st.st_size * 2U + STREAM_BLOCK_BYTES;
+    if (bytes > (u64)SIZE_MAX)
+      return set_error(err_buf, err_len, "file exceeds MAX_DECK_BYTES");
+    /* Tables of a pipe start at a block and grow with the text (see
+     * stream_tables).
+     */
+    if (sized)
+      table_bytes = bytes;
+    rc = reserve_tables(session, table_bytes, err_buf, err_len);
+    if (rc == 0)
+      rc = stream_fd_into_session(
+          fd, (size_t)bytes, opts->pipeline, session, err_buf, err_len);
+    if (rc == 0 && opts->watch)
+      rc = reserve_spare(session, (size_t)bytes, err_buf, err_len);
+  }
+  if (rc != 0)
+    return -1;
+  if (elapsed_since(&t0, &session->parse_ns) != 0)
+    return set_error(err_buf, err_len, "failed to read clock");
+  return 0;
+}
+
+int parse_session_file(const char* path,
+    const struct ParseOptions* opts,
+    struct Session* session,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(path))
+    return -1;
+  if (!validate_ptr(opts))
+    return -1;
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+
+  int rc = session_init(session);
+
+  if (rc != 0)
+    return set_error(err_buf, err_len, "failed to init session");
+
+  int from_stdin = (strcmp(path, "-") == 0);
+  int fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return set_errno_error(err_buf, err_len, "open", path);
+  rc = load_and_parse(fd, path, opts, session, err_buf, err_len);
+  if (!from_stdin && close(fd) != 0)
+    return set_error(err_buf, err_len, "failed to close file");
+  return rc;
+}
+
+/* Hot reload. The new text is read into the spare reservation and
+ * compared with the current one; only the groups that overlap the changed
+ * bytes are parsed again. Tables after the change are parked at the top
+ * of the stores while the middle is parsed, then moved down into place
+ * with their offsets shifted.
+ */
+#define RELOAD_CMP_BLOCK 4096U
+
+struct reload_plan {
+  size_t g_start;
+  size_t g_end;
+  size_t start;
+  size_t end;
+};
+
+static size_t common_prefix(const char* a, const char* b, size_t len) {
+  size_t pos = 0;
+
+  for (u64 i = 0; i <= MAX_DECK_BYTES / RELOAD_CMP_BLOCK; i++) {
+    size_t n = min_size(len - pos, RELOAD_CMP_BLOCK);
+
+    if (n == 0 || memcmp(a + pos, b + pos, n) != 0)
+      break;
+    pos += n;
+  }
+  for (size_t i = 0; i < RELOAD_CMP_BLOCK; i++) {
+    if (pos >= len || a[pos] != b[pos])
+      break;
+    pos++;
+  }
+  return pos;
+}
+
+/* Common tail of a and b, at most `limit` bytes. */
+static size_t common_suffix(
+    const char* a_end, const char* b_end, size_t limit) {
+  size_t len = 0;
+
+  for (u64 i = 0; i <= MAX_DECK_BYTES / RELOAD_CMP_BLOCK; i++) {
+    size_t n = min_size(limit - len, RELOAD_CMP_BLOCK);
+
+    if (n == 0 || memcmp(a_end - len - n, b_end - len - n, n) != 0)
+      break;
+    len += n;
+  }
+  for (size_t i = 0; i < RELOAD_CMP_BLOCK; i++) {
+    if (len >= limit || *(a_end - len - 1) != *(b_end - len - 1))
+      break;
+    len++;
+  }
+  return len;
+}
+
+/* Number of groups whose header line starts before `offset`. */
+static size_t groups_before(const struct Session* session, size_t offset) {
+  size_t lo = 0;
+  size_t hi = session->group_count;
+
+  for (size_t i = 0; i < 64U; i++) {
+    if (lo >= hi)
+      break;
+    size_t mid = lo + (hi - lo) / 2U;
+
+    if (header_start(session, mid) < offset)
+      lo = mid + 1U;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Widens the changed bytes [prefix, old_len - suffix) to whole groups:
+ * from the header of the group that holds the first changed byte (or the
+ * start of the text) to the first header that is entirely unchanged.
+ */
+static void plan_reload(const struct Session* session,
+    size_t prefix,
+    size_t suffix,
+    struct reload_plan* plan) {
+  size_t before = groups_before(session, prefix);
+
+  plan->g_start = (before > 0) ? before - 1U : 0;
+  plan->start = (before > 0) ? header_start(session, before - 1U) : 0;
+  plan->g_end = groups_before(session, session->text_len - suffix + 1U);
+  plan->end = (plan->g_end < session->group_count)
+      ? header_start(session, plan->g_end)
+      : session->text_len;
+}
+
+static void move_groups(struct Group* groups,
+    size_t dst,
+    size_t src,
+    size_t count,
+    u64 text_shift,
+    u64 item_shift) {
+  memmove(&groups[dst], &groups[src], count * sizeof(struct Group));
+  for (size_t i = 0; i < MAX_GROUPS; i++) {
+    if (i >= count)
+      break;
+    struct Group* g = &groups[dst + i];
+
+    g->name_offset += text_shift;
+    g->item_start = (u32)((u64)g->item_start + item_shift);
+  }
+}
+
+/* Item offsets are relative to their group, so text shifts leave them. */
+static void move_items(
+    struct Item* items, size_t dst, size_t src, size_t count) {
+  memmove(&items[dst], &items[src], count * sizeof(struct Item));
+}
+
+/* Re-parses new_text over the planned range. Offsets and indexes move by
+ * unsigned wrap-around, so shrinking edits need no special case.
+ */
+static int reload_range(struct Session* session,
+    const char* new_text,
+    size_t new_len,
+    const struct reload_plan* plan,
+    char* err_buf,
+    size_t err_len) {
+  size_t old_groups = session->group_count;
+  size_t old_items = session->item_count;
+  size_t i_start = (plan->g_start > 0)
+      ? session->groups[plan->g_start].item_start
+      : 0;
+  size_t i_end = (plan->g_end < old_groups)
+      ? session->groups[plan->g_end].item_start
+      : old_items;
+  size_t tail_groups = old_groups - plan->g_end;
+  size_t tail_items = old_items - i_end;
+  u64 text_shift = (u64)new_len - (u64)session->text_len;
+  size_t new_end = (size_t)((u64)plan->end + text_shift);
+  int last = (plan->g_end >= old_groups);
+
+  size_t group_park = session->group_cap - tail_groups;
+  size_t item_park = session->item_cap - tail_items;
+
+  move_groups(session->groups,
+      group_park,
+      plan->g_end,
+      tail_groups,
+      0,
+      0);
+  move_items(session->items, item_park, i_end, tail_items);
+
+  struct parse_state state;
+  struct parse_tables t;
+  size_t consumed = 0;
+
+  parse_state_init(&state);
+  session_tables(session, &t);
+  t.group_count = plan->g_start;
+  t.group_cap = group_park;
+  t.item_count = i_start;
+  t.item_cap = item_park;
+  /* Bodies that end at a kept header end in '\n' (see lazy_items). */
+  if ((plan->start < new_end || last) &&
+      parse_range(&t,
+          &state,
+          new_text,
+          plan->start,
+          new_end - plan->start,
+          !last,
+          &consumed,
+          err_buf,
+          err_len) != 0)
+    return -1;
+  if (last && parse_finish(&t, &state, err_buf, err_len) != 0)
+    return -1;
+  if (!last && state.has_group &&
+      t.groups[state.current_group].item_count == 0)
+    return set_error_line(
+        err_buf, err_len, state.line_no, "previous group has no items");
+
+  move_groups(session->groups,
+      t.group_count,
+      group_park,
+      tail_groups,
+      text_shift,
+      (u64)t.item_count - (u64)i_end);
+  move_items(session->items, t.item_count, item_park, tail_items);
+  session->group_count = t.group_count + tail_groups;
+  session->item_count = t.item_count + tail_items;
+  return 0;
+}
+
+static int reload_read(struct Session* session,
+    const char* path,
+    size_t* out_len,
+    char* err_buf,
+    size_t err_len) {
+  if (!assert_ptr(session->spare_addr))
+    return -1;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return set_errno_error(err_buf, err_len, "open", path);
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0) {
+    (void)close(fd);
+    return set_errno_error(err_buf, err_len, "stat", path);
+  }
+  if ((u64)st.st_size > MAX_DECK_BYTES - STREAM_BLOCK_BYTES) {
+    (void)close(fd);
+    return set_error(err_buf, err_len, "file exceeds MAX_DECK_BYTES");
+  }
+
+  /* The spare was reserved at load, like the tables, for twice the deck;
+   * nothing is allocated while the runner is live.
+   */
+  if ((u64)st.st_size >= (u64)session->spare_len) {
+    (void)close(fd);
+    return set_error(err_buf, err_len, "deck grew past twice its size");
+  }
+
+  char* base = (char*)session->spare_addr;
+  size_t len = 0;
+  int rc = 0;
+
+  for (u64 i = 0; i <= MAX_DECK_BYTES / STREAM_BLOCK_BYTES; i++) {
+    ssize_t n = stream_read_block(fd, base, session->spare_len, len);
+
+    if (n < 0) {
+      if (n != -(ssize_t)STREAM_EOF)
+        rc = stream_status_error((u32)-n, err_buf, err_len);
+      break;
+    }
+    len += (size_t)n;
+  }
+  if (close(fd) != 0 && rc == 0)
+    rc = set_error(err_buf, err_len, "failed to close file");
+  if (rc == 0 && image_detect(base, len))
+    rc = set_error(err_buf, err_len, "compiled decks cannot be watched");
+  *out_len = len;
+  return rc;
+}
+
+static void release_text(void* addr, size_t len) {
+  long page = sysconf(_SC_PAGESIZE);
+  size_t span = len;
+
+  if (page > 0)
+    span = (len + (size_t)page - 1U) / (size_t)page * (size_t)page;
+  if (span > 0)
+    (void)madvise(addr, span, MADV_DONTNEED);
+}
+
+static int same_name(const char* a_text,
+    const struct Group* a,
+    const char* b_text,
+    const struct Group* b) {
+  const char* a_name = a_text + a->name_offset;
+  const char* b_name = b_text + b->name_offset;
+
+  return a->name_length == b->name_length &&
+      memcmp(a_name, b_name, a->name_length) == 0;
+}
+
+/* The items of one group and the text they point into. */
+struct group_lines {
+  const char* text;
+  size_t text_len;
+  u64 base;
+  const struct Item* items;
+};
+
+static int same_item(const struct group_lines* a,
+    size_t a_index,
+    const struct group_lines* b,
+    size_t b_index) {
+  size_t a_start = (size_t)(a->base + a->items[a_index].offset);
+  size_t b_start = (size_t)(b->base + b->items[b_index].offset);
+  size_t a_len = scan_line_length(a->text, a->text_len, a_start);
+  size_t b_len = scan_line_length(b->text, b->text_len, b_start);
+
+  return a_len == b_len &&
+      memcmp(a->text + a_start, b->text + b_start, a_len) == 0;
+}
+
+/* Extends the unchanged head and tail of a renumbering by comparing the
+ * entries in between: group names, or item text.
+ */
+static void match_groups(const struct Session* session,
+    const char* old_text,
+    const struct ReloadMap* map,
+    struct ReloadSpan* span) {
+  const struct Group* old_g = map->saved_groups;
+  const struct Group* new_g = session->groups;
+
+  for (size_t i = 0; i < MAX_GROUPS; i++) {
+    size_t k = span->head;
+
+    if (k + span->tail >= min_size(span->old_count, span->new_count))
+      break;
+    if (!same_name(old_text, &old_g[k], session->text, &new_g[k]))
+      break;
+    span->head++;
+  }
+  for (size_t i = 0; i < MAX_GROUPS; i++) {
+    if (span->head + span->tail >= min_size(span->old_count, span->new_count))
+      break;
+    size_t a = span->old_count - span->tail - 1U;
+    size_t b = span->new_count - span->tail - 1U;
+
+    if (!same_name(old_text, &old_g[a], session->text, &new_g[b]))
+      break;
+    span->tail++;
+  }
+}
+
+static void match_items(const struct Session* session,
+    const char* old_text,
+    size_t old_len,
+    const struct ReloadMap* map,
+    struct ReloadSpan* span) {
+  const struct Group* new_g = &session->groups[map->group_new];
+  const struct group_lines old_i = {
+    .text = old_text,
+    .text_len = old_len,
+    .base = map->saved_groups[map->group].name_offset,
+    .items = map->saved_items,
+  };
+  const struct group_lines new_i = {
+    .text = session->text,
+    .text_len = session->text_len,
+    .base = new_g->name_offset,
+    .items = &session->items[new_g->item_start],
+  };
+
+  for (size_t i = 0; i < MAX_ITEMS_PER_GROUP; i++) {
+    size_t k = span->head;
+
+    if (k + span->tail >= min_size(span->old_count, span->new_count))
+      break;
+    if (!same_item(&old_i, k, &new_i, k))
+      break;
+    span->head++;
+  }
+  for (size_t i = 0; i < MAX_ITEMS_PER_GROUP; i++) {
+    if (span->head + span->tail >= min_size(span->old_count, span->new_count))
+      break;
+    size_t a = span->old_count - span->tail - 1U;
+    size_t b = span->new_count - span->tail - 1U;
+
+    if (!same_item(&old_i, a, &new_i, b))
+      break;
+    span->tail++;
+  }
+}
+
+int reload_index(const struct ReloadSpan* span, size_t old, size_t* out_new) {
+  if (!validate_ptr(span))
+    return -1;
+  if (!validate_ptr(out_new))
+    return -1;
+  if (!assert_ok(old < span->old_count))
+    return -1;
+
+  if (old < span->head) {
+    *out_new = old;
+    return 0;
+  }
+  if (old >= span->old_count - span->tail) {
+    *out_new = old - span->old_count + span->new_count;
+    return 0;
+  }
+  return -1;
+}
+
+static void fill_reload_map(const struct Session* session,
+    const char* old_text,
+    size_t old_len,
+    const struct reload_plan* plan,
+    size_t old_groups,
+    struct ReloadMap* map) {
+  map->groups.head = plan->g_start;
+  map->groups.tail = old_groups - plan->g_end;
+  map->groups.old_count = old_groups;
+  map->groups.new_count = session->group_count;
+  match_groups(session, old_text, map, &map->groups);
+
+  map->group_kept =
+      (reload_index(&map->groups, map->group, &map->group_new) == 0);
+  map->items.head = 0;
+  map->items.tail = 0;
+  map->items.old_count = map->saved_groups[map->group].item_count;
+  map->items.new_count = 0;
+  if (!map->group_kept)
+    return;
+  map->items.new_count = session->groups[map->group_new].item_count;
+  match_items(session, old_text, old_len, map, &map->items);
+}
+
+/* Groups the reload re-parsed may not outgrow the stored orders; the
+ * others had room before.
+ */
+static int check_prompt_cap(const struct Session* session,
+    const struct reload_plan* plan,
+    size_t old_groups,
+    const struct ReloadMap* map,
+    char* err_buf,
+    size_t err_len) {
+  size_t end = session->group_count - (old_groups - plan->g_end);
+
+  for (size_t g = plan->g_start; g < MAX_GROUPS; g++) {
+    if (g >= end)
+      break;
+    if (session_prompt_count(session, g) > map->prompt_cap)
+      return set_error(err_buf, err_len, "group has too many prompts");
+  }
+  return 0;
+}
+
+int parse_session_reload(struct Session* session,
+    const char* path,
+    struct ReloadMap* map,
+    char* err_buf,
+    size_t err_len) {
+  if (!validate_ptr(session))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+  if (!validate_ptr(map))
+    return -1;
+  if (!assert_ok(session->group_cap > 0))
+    return -1;
+  if (!validate_ptr(map->saved_groups))
+    return -1;
+  if (!validate_ptr(map->saved_items))
+    return -1;
+  if (!assert_ok(map->group < session->group_count))
+    return -1;
+  if (!validate_ok(map->prompt_cap > 0))
+    return -1;
+
+  u64 t0 = now_ns();
+  size_t new_len = 0;
+
+  if (reload_read(session, path, &new_len, err_buf, err_len) != 0) {
+    release_text(session->spare_addr, new_len);
+    return -1;
+  }
+
+  const char* old_text = session->text;
+  size_t old_len = session->text_len;
+  size_t old_groups = session->group_count;
+  const char* new_text = (const char*)session->spare_addr;
+  size_t prefix = common_prefix(old_text, new_text, min_size(old_len, new_len));
+  size_t suffix = common_suffix(old_text + old_len,
+      new_text + new_len,
+      min_size(old_len, new_len) - prefix);
+  const struct Group* cur = &session->groups[map->group];
+  struct reload_plan plan;
+
+  memcpy(map->saved_groups, session->groups, old_groups * sizeof(struct Group));
+  memcpy(map->saved_items,
+      &session->items[cur->item_start],
+      cur->item_count * sizeof(struct Item));
+  /* Saved without changes. */
+  if (prefix == old_len && old_len == new_len) {
+    release_text(session->spare_addr, new_len);
+    map->groups.head = old_groups;
+    map->groups.tail = 0;
+    map->groups.old_count = old_groups;
+    map->groups.new_count = old_groups;
+    map->group_kept = 1;
+    map->group_new = map->group;
+    map->items.head = cur->item_count;
+    map->items.tail = 0;
+    map->items.old_count = cur->item_count;
+    map->items.new_count = cur->item_count;
+    map->parsed_bytes = 0;
+    map->ns = now_ns() - t0;
+    return 0;
+  }
+  plan_reload(session, prefix, suffix, &plan);
+
+  int rc = reload_range(session, new_text, new_len, &plan, err_buf, err_len);
+
+  /* The partial result is gone; a full pass gives the exact error line. */
+  if (rc != 0) {
+    plan.g_start = 0;
+    plan.g_end = old_groups;
+    plan.start = 0;
+    plan.end = old_len;
+    rc = reload_range(session, new_text, new_len, &plan, err_buf, err_len);
+  }
+  if (rc == 0)
+    rc = check_prompt_cap(session, &plan, old_groups, map, err_buf, err_len);
+  if (rc != 0) {
+    char scratch[64];
+
+    /* The previous text parsed before, so this restores its tables. */
+    (void)parse_session_buffer(session, scratch, sizeof(scratch));
+    release_text(session->spare_addr, new_len);
+    return -1;
+  }
+
+  void* old_addr = session->map_addr;
+  size_t old_cap = session->map_len;
+
+  session->map_addr = session->spare_addr;
+  session->map_len = session->spare_len;
+  session->spare_addr = old_addr;
+  session->spare_len = old_cap;
+  session->text = new_text;
+  session->text_len = new_len;
+  session->has_text_cksum = 0;
+  fill_reload_map(session, old_text, old_len, &plan, old_groups, map);
+  map->parsed_bytes = (size_t)((u64)plan.end + (u64)new_len - (u64)old_len) -
+      plan.start;
+  release_text(old_addr, old_len);
+  map->ns = now_ns() - t0;
   return 0;
 }
@@ -5,6 +5,8 @@
 #include <time.h>
 #include <unistd.h>
 
+__extension__ typedef unsigned __int128 u128;
+
 static u64 mix64(u64 x) {
   x ^= x >> 33;
   x *= 0xff51afd7ed558ccdULL;
@@ -47,12 +49,8 @@ int rng_init(struct Rng* rng) {
   return 0;
 }
 
-u64 rng_next_u64(struct Rng* rng) {
-  if (!validate_ptr(rng))
-    return 0;
-  if (!assert_ok(rng->state != 0))
-    return 0;
-
+/* xorshift64*: callers have checked rng and its state. */
+static inline u64 next_u64(struct Rng* rng) {
   u64 x = rng->state;
 
   x ^= x >> 12;
@@ -62,38 +60,65 @@ u64 rng_next_u64(struct Rng* rng) {
   return x * 0x2545F4914F6CDD1DULL;
 }
 
-size_t rng_range(struct Rng* rng, size_t upper) {
+u64 rng_next_u64(struct Rng* rng) {
   if (!validate_ptr(rng))
     return 0;
-  if (!validate_ok(upper > 0))
+  if (!assert_ok(rng->state != 0))
     return 0;
 
-  u64 threshold = (u64)(-upper) % upper;
+  return next_u64(rng);
+}
 
-  for (size_t i = 0; i < RNG_RETRY_LIMIT; i++) {
-    u64 r = rng_next_u64(rng);
+/* Maps r to [0, upper) as the high word of r * upper (Lemire). The low
+ * word tells whether r falls in the few values that would bias the
+ * result; only then is the threshold computed with a division and a
+ * fresh value drawn.
+ */
+static inline u64 bounded(struct Rng* rng, u64 r, u64 upper) {
+  u128 m = (u128)r * upper;
+  u64 low = (u64)m;
+
+  if (low >= upper)
+    return (u64)(m >> 64);
+
+  u64 threshold = (0 - upper) % upper;
 
-    if (r >= threshold)
-      return (size_t)(r % upper);
+  for (size_t i = 0; i < RNG_RETRY_LIMIT; i++) {
+    if (low >= threshold)
+      break;
+    m = (u128)next_u64(rng) * upper;
+    low = (u64)m;
   }
-  return (size_t)(rng_next_u64(rng) % upper);
+  return (u64)(m >> 64);
+}
+
+size_t rng_range(struct Rng* rng, size_t upper) {
+  if (!validate_ptr(rng))
+    return 0;
+  if (!assert_ok(rng->state != 0))
+    return 0;
+  if (!validate_ok(upper > 0))
+    return 0;
+
+  return (size_t)bounded(rng, next_u64(rng), (u64)upper);
 }
 
-int rng_shuffle_groups(struct Rng* rng, size_t* values, size_t count) {
+int rng_shuffle(struct Rng* rng, u32* values, size_t count) {
   if (!validate_ptr(rng))
     return -1;
+  if (!assert_ok(rng->state != 0))
+    return -1;
   if (!validate_ptr(values))
     return -1;
-  if (!validate_ok(count <= MAX_GROUPS))
+  if (!validate_ok(count <= ORDER_MAX_ENTRIES))
     return -1;
 
-  if (count < 2)
-    return 0;
-  for (size_t i = 1; i < MAX_GROUPS; i++) {
-    if (i >= count)
+  for (size_t k = 1; k < ORDER_MAX_ENTRIES; k++) {
+    if (k >= count)
       break;
-    size_t j = rng_range(rng, i + 1);
-    size_t tmp = values[i];
+    size_t i = count - k;
+    size_t j = (size_t)bounded(rng, next_u64(rng), (u64)i + 1U);
+    u32 tmp = values[i];
 
     values[i] = values[j];
     values[j] = tmp;
@@ -101,24 +126,229 @@ int rng_shuffle_groups(struct Rng* rng, size_t* values, size_t count) {
   return 0;
 }
 
-int rng_shuffle_items(struct Rng* rng, size_t* values, size_t count) {
+static u64 factorial(u32 n) {
+  u64 f = 1;
+
+  for (u32 k = 2; k <= PERM_SMALL_MAX; k++) {
+    if (k > n)
+      break;
+    f *= k;
+  }
+  return f;
+}
+
+/* Half the width of the Feistel network for count entries; 0 for the
+ * ranked orders of small counts.
+ */
+static u32 half_bits(size_t count) {
+  if (count <= PERM_SMALL_MAX)
+    return 0;
+
+  u32 bits = 0;
+
+  for (u32 b = 0; b < 32U; b++) {
+    if (((u64)(count - 1U) >> b) == 0)
+      break;
+    bits = b + 1U;
+  }
+  return (bits + 1U) / 2U;
+}
+
+int rng_perm_init(struct Permutation* perm, struct Rng* rng, size_t count) {
+  if (!validate_ptr(perm))
+    return -1;
   if (!validate_ptr(rng))
     return -1;
-  if (!validate_ptr(values))
+  if (!validate_ok(count > 0 && count <= ORDER_MAX_ENTRIES))
     return -1;
-  if (!validate_ok(count <= MAX_ITEMS_PER_GROUP))
+
+  perm->count = (u32)count;
+  perm->half_bits = half_bits(count);
+  if (count <= PERM_SMALL_MAX)
+    perm->key = (u64)rng_range(rng, (size_t)factorial((u32)count));
+  else
+    perm->key = rng_next_u64(rng);
+  return 0;
+}
+
+int rng_perm_save(
+    const struct Permutation* perm, size_t pos, struct PermCursor* out) {
+  if (!validate_ptr(perm))
+    return -1;
+  if (!validate_ptr(out))
+    return -1;
+  if (!assert_ok(pos <= perm->count))
+    return -1;
+
+  out->key = perm->key;
+  out->count = perm->count;
+  out->pos = (u32)pos;
+  return 0;
+}
+
+int rng_perm_load(struct Permutation* perm, const struct PermCursor* cursor) {
+  if (!validate_ptr(perm))
+    return -1;
+  if (!validate_ptr(cursor))
+    return -1;
+  if (!validate_ok(cursor->count > 0 && cursor->pos <= cursor->count))
     return -1;
 
-  if (count < 2)
+  perm->key = cursor->key;
+  perm->count = cursor->count;
+  perm->half_bits = half_bits(cursor->count);
+  return 0;
+}
+
+/* Entry i of the order ranked `key`: digit j of the rank in the factorial
+ * number system picks among the entries not yet taken.
+ */
+static u32 perm_small_at(const struct Permutation* perm, size_t index) {
+  u32 n = perm->count;
+  u64 rest = perm->key;
+  u64 radix = factorial(n - 1U);
+  u32 taken = 0;
+  u32 value = 0;
+
+  for (u32 j = 0; j < PERM_SMALL_MAX; j++) {
+    if (j > index)
+      break;
+    u64 digit = rest / radix;
+    u64 skip = 0;
+
+    rest %= radix;
+    if (n - 1U - j > 0)
+      radix /= n - 1U - j;
+    for (u32 v = 0; v < PERM_SMALL_MAX; v++) {
+      if (v >= n)
+        break;
+      if (taken & (1U << v))
+        continue;
+      if (skip == digit) {
+        value = v;
+        break;
+      }
+      skip++;
+    }
+    taken |= 1U << value;
+  }
+  return value;
+}
+
+static u64 perm_encrypt(const struct Permutation* perm, u64 x) {
+  u64 mask = (1ULL << perm->half_bits) - 1U;
+  u64 left = x >> perm->half_bits;
+  u64 right = x & mask;
+
+  for (u64 r = 0; r < PERM_ROUNDS; r++) {
+    u64 f = mix64(perm->key ^ (r << 32) ^ right) & mask;
+    u64 next = left ^ f;
+
+    left = right;
+    right = next;
+  }
+  return (left << perm->half_bits) | right;
+}
+
+u32 rng_perm_at(const struct Permutation* perm, size_t index) {
+  if (!validate_ptr(perm))
+    return 0;
+  if (!assert_ok(index < perm->count))
     return 0;
-  for (size_t i = 1; i < MAX_ITEMS_PER_GROUP; i++) {
-    if (i >= count)
+
+  if (perm->half_bits == 0)
+    return perm_small_at(perm, index);
+
+  /* Values past count lead back into range along the cycle through
+   * index; the domain is under 4 * count, so that takes few steps.
+   */
+  u64 domain = 1ULL << (2U * perm->half_bits);
+  u64 x = perm_encrypt(perm, (u64)index);
+
+  for (u64 walk = 0; walk < domain; walk++) {
+    if (x < perm->count)
       break;
-    size_t j = rng_range(rng, i + 1);
-    size_t tmp = values[i];
+    x = perm_encrypt(perm, x);
+  }
+  return (u32)x;
+}
 
-    values[i] = values[j];
-    values[j] = tmp;
+int rng_order_init(
+    struct ShuffleOrder* order, u32* values, u32* stamps, size_t cap) {
+  if (!validate_ptr(order))
+    return -1;
+  if (!validate_ptr(values))
+    return -1;
+  if (!validate_ptr(stamps))
+    return -1;
+
+  order->values = values;
+  order->stamps = stamps;
+  order->cap = cap;
+  order->stamp = 1;
+  return 0;
+}
+
+int rng_order_reset(struct ShuffleOrder* order) {
+  if (!validate_ptr(order))
+    return -1;
+
+  order->stamp++;
+  if (order->stamp != 0)
+    return 0;
+  /* Once per 2^32 resets, old stamps could come back into use. */
+  for (size_t i = 0; i < ORDER_MAX_ENTRIES; i++) {
+    if (i >= order->cap)
+      break;
+    order->stamps[i] = 0;
   }
+  order->stamp = 1;
+  return 0;
+}
+
+u32 rng_order_at(const struct ShuffleOrder* order, size_t index) {
+  if (!validate_ptr(order))
+    return 0;
+  if (!assert_ok(index < order->cap))
+    return 0;
+
+  if (order->stamps[index] != order->stamp)
+    return (u32)index;
+  return order->values[index];
+}
+
+int rng_order_put(struct ShuffleOrder* order, size_t index, u32 value) {
+  if (!validate_ptr(order))
+    return -1;
+  if (!assert_ok(index < order->cap))
+    return -1;
+
+  order->values[index] = value;
+  order->stamps[index] = order->stamp;
+  return 0;
+}
+
+int rng_order_draw(struct Rng* rng,
+    struct ShuffleOrder* order,
+    size_t pos,
+    size_t count,
+    u32* out) {
+  if (!validate_ptr(rng))
+    return -1;
+  if (!validate_ptr(order))
+    return -1;
+  if (!validate_ptr(out))
+    return -1;
+  if (!assert_ok(pos < count && count <= order->cap))
+    return -1;
+
+  size_t j = pos + rng_range(rng, count - pos);
+  u32 picked = rng_order_at(order, j);
+
+  if (j != pos && rng_order_put(order, j, rng_order_at(order, pos)) != 0)
+    return -1;
+  if (rng_order_put(order, pos, picked) != 0)
+    return -1;
+  *out = picked;
   return 0;
 }
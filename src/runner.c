@@ -2,12 +2,14 @@
 #include "runner.h"
 #include "config.h"
 #include "log.h"
+#include "loop.h"
 #include "model.h"
+#include "parser.h"
 #include "rng.h"
 #include "term.h"
+#include "watch.h"
 
 #include <ctype.h>
-#include <stdio.h>
 #include <string.h>
 #include <time.h>
 
@@ -15,18 +17,65 @@ struct runtime {
   size_t order_pos;
   size_t group_index;
   size_t item_pos;
-  size_t item_index;
-  u64 group_end;
+  /* Prompt on screen, numbered within its group (see session_prompt). */
+  size_t prompt;
   int pending_switch;
+  /* Once the timer has expired, the next group is drawn and its first
+   * prompt rendered while waiting for the key that shows it; group_index,
+   * item_pos and prompt then already describe that group.
+   */
+  int next_ready;
+  /* g_frame holds the frame of prompt frame_prompt of group frame_group
+   * when frame_ready, built ahead of the key that draws it where that
+   * prompt is known; decode_ns is what rendering it took.
+   */
+  int frame_ready;
+  size_t frame_group;
+  size_t frame_prompt;
+  u64 frame_decode_ns;
+  /* Keys of the last wakeup not handled yet, from key_pos on. Keys
+   * before last_advance are followed by another advance in the batch, so
+   * the prompts they bring are logged but not drawn (skip_draw), and
+   * counted in skipped until a prompt is drawn.
+   */
+  struct LoopEvents events;
+  size_t key_pos;
+  size_t last_advance;
+  int skip_draw;
+  size_t skipped;
+  /* Rounds over the groups of a deck whose orders are not stored, and
+   * over the current group's prompts (see RunOrders).
+   */
+  struct Permutation group_perm;
+  struct Permutation item_perm;
+  /* The current round over the prompts is in the stored item order
+   * (a reload renumbered them) rather than in item_perm.
+   */
+  int items_stored;
 };
 
 struct ctx {
   struct Session* session;
   struct Rng* rng;
-  size_t* group_order;
-  size_t* item_order;
+  /* One per group, zeroed until the group is left mid-round. */
+  struct PermCursor* cursors;
+  size_t cursor_cap;
+  /* Stored orders of a watched deck; NULL otherwise. */
+  struct ShuffleOrder* group_order;
+  struct ShuffleOrder* item_order;
+  char* err_buf;
+  size_t err_len;
+  struct Watch* watch;
+  struct ReloadMap* reload;
+  struct EventLoop* loop;
 };
 
+/* Generated prompts are rendered here before they are drawn and logged. */
+static char g_prompt_buf[MAX_LINE_LEN];
+/* What is on the terminal, and the next frame to draw over it. */
+static struct TermScreen g_screen;
+static struct TermFrame g_frame;
+
 static int assert_session_bounds(const struct Session* session) {
   if (!validate_ptr(session))
     return -1;
@@ -39,6 +88,9 @@ static int assert_session_bounds(const struct Session* session) {
     if (i >= session->group_count)
       break;
     size_t count = session->groups[i].item_count;
+    /* Lazily parsed groups are checked when they are loaded. */
+    if (session->lazy && count == 0)
+      continue;
     if (!assert_ok(count > 0))
       return -1;
     if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
@@ -47,52 +99,149 @@ static int assert_session_bounds(const struct Session* session) {
   return 0;
 }
 
-static int now_ms(u64* out_ms) {
-  if (!validate_ptr(out_ms))
+static u64 now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+/* Produces the text of a prompt; packed decks decode the line here,
+ * and the log reports how long it took.
+ */
+static int render_prompt(const struct ctx* c,
+    size_t group_index,
+    size_t prompt,
+    const char** text,
+    size_t* len,
+    u64* decode_ns) {
+  if (!validate_ptr(c))
     return -1;
 
-  struct timespec ts;
-  int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+  u64 t0 = now_ns();
+  int rc = session_prompt(
+      c->session, group_index, prompt, g_prompt_buf, text, len);
 
-  if (rc != 0)
+  *decode_ns = now_ns() - t0;
+  return rc;
+}
+
+/* Lays out the frame of a prompt in g_frame, unless it is already there
+ * and the screen has not changed since.
+ */
+static int build_frame(const struct ctx* c,
+    struct runtime* rt,
+    size_t group_index,
+    size_t prompt) {
+  if (!validate_ptr(rt))
+    return -1;
+  if (rt->frame_ready && rt->frame_group == group_index &&
+      rt->frame_prompt == prompt && term_frame_fresh(&g_screen, &g_frame))
+    return 0;
+
+  const char* text = NULL;
+  size_t len = 0;
+  u64 decode_ns = 0;
+
+  rt->frame_ready = 0;
+  if (render_prompt(c, group_index, prompt, &text, &len, &decode_ns) != 0)
+    return -1;
+  if (term_build_frame(&g_screen, &g_frame, text, len) != 0)
     return -1;
-  *out_ms = (u64)ts.tv_sec * 1000ULL + (u64)(ts.tv_nsec / 1000000ULL);
+  rt->frame_group = group_index;
+  rt->frame_prompt = prompt;
+  rt->frame_decode_ns = decode_ns;
+  rt->frame_ready = 1;
   return 0;
 }
 
-static int draw_prompt(const struct Session* session, size_t item_index) {
-  if (!validate_ptr(session))
-    return -1;
-  if (!assert_ok(item_index < session->item_count))
+/* Logs the prompt whose frame was built, from the frame's copy. */
+static int log_frame(const struct ctx* c, const struct runtime* rt) {
+  if (!assert_ok(rt->frame_ready))
     return -1;
-  if (!assert_ok(session->buffer_len > 0))
+
+  return log_prompt(c->session,
+      rt->frame_group,
+      rt->frame_prompt,
+      g_frame.text,
+      g_frame.text_len,
+      rt->frame_decode_ns);
+}
+
+/* Draws the built frame, unless a later key of the same batch replaces
+ * it.
+ */
+static int put_frame(struct runtime* rt) {
+  if (!assert_ok(rt->frame_ready))
     return -1;
 
-  struct Item item = session->items[item_index];
+  if (rt->skip_draw) {
+    rt->skipped++;
+    return 0;
+  }
+  if (rt->skipped > 0) {
+    int rc = log_frames(rt->skipped);
+
+    if (rc != 0)
+      return -1;
+    rt->skipped = 0;
+  }
+  return term_write_frame(&g_screen, &g_frame);
+}
 
-  if (!assert_ok(item.length > 0))
+static int show_prompt(const struct ctx* c, struct runtime* rt) {
+  if (!validate_ptr(c))
     return -1;
-  if (!assert_ok(
-          (size_t)item.offset + (size_t)item.length <= session->buffer_len))
+  if (!validate_ptr(rt))
     return -1;
 
-  int rc = term_clear_screen();
+  /* A prompt that is not drawn needs no frame, and leaves a frame built
+   * for a later prompt of the batch in place.
+   */
+  if (rt->skip_draw) {
+    const char* text = NULL;
+    size_t len = 0;
+    u64 decode_ns = 0;
+    int rc =
+        render_prompt(c, rt->group_index, rt->prompt, &text, &len, &decode_ns);
 
-  if (rc != 0)
-    return -1;
+    if (rc != 0)
+      return -1;
+    rt->skipped++;
+    return log_prompt(
+        c->session, rt->group_index, rt->prompt, text, len, decode_ns);
+  }
 
-  const char* text = session->buffer + item.offset;
-  size_t written = fwrite(text, 1, item.length, stdout);
+  int rc = build_frame(c, rt, rt->group_index, rt->prompt);
 
-  if (!assert_ok(written == item.length))
-    return -1;
-  rc = fputc('\n', stdout);
-  if (!assert_ok(rc != EOF))
+  if (rc != 0)
     return -1;
-  rc = fflush(stdout);
+  rc = put_frame(rt);
   if (rc != 0)
     return -1;
-  return 0;
+  return log_frame(c, rt);
+}
+
+/* Builds, while waiting for a key, the frame the next advance will draw
+ * if that prompt is already known: the next entry of a keyed round. A
+ * prepared switch has its frame built, and a stored round's next entry
+ * is only drawn by the advance itself.
+ */
+static int prepare_frame(const struct ctx* c, struct runtime* rt) {
+  if (!validate_ptr(c))
+    return -1;
+  if (!validate_ptr(rt))
+    return -1;
+  if (rt->pending_switch || rt->items_stored)
+    return 0;
+
+  size_t count = session_prompt_count(c->session, rt->group_index);
+  size_t next = rt->item_pos + 1U;
+
+  if (next >= count)
+    return 0;
+  return build_frame(c, rt, rt->group_index, rng_perm_at(&rt->item_perm, next));
 }
 
 static int is_advance_key(int key) {
@@ -105,54 +254,107 @@ static int is_advance_key(int key) {
   return isalnum((unsigned char)key) != 0;
 }
 
-static int init_group_order(const struct ctx* c) {
+/* Starts a round over `count` entries: a fresh permutation, or the
+ * stored order back to the identity, to be shuffled as it is drawn.
+ */
+static int start_round(const struct ctx* c,
+    struct ShuffleOrder* order,
+    struct Permutation* perm,
+    size_t count) {
+  if (!order)
+    return rng_perm_init(perm, c->rng, count);
+  if (!assert_ok(count <= order->cap))
+    return -1;
+  return rng_order_reset(order);
+}
+
+/* Entry `pos` of the current round over `count` entries. */
+static int round_entry(const struct ctx* c,
+    struct ShuffleOrder* order,
+    const struct Permutation* perm,
+    size_t pos,
+    size_t count,
+    u32* out) {
+  if (order)
+    return rng_order_draw(c->rng, order, pos, count, out);
+  if (!assert_ok(perm->count == count))
+    return -1;
+  *out = rng_perm_at(perm, pos);
+  return 0;
+}
+
+/* Starts a fresh round over the current group's prompts. */
+static int shuffle_group_items(const struct ctx* c, struct runtime* rt) {
   if (!validate_ptr(c))
     return -1;
-  if (!validate_ptr(c->session))
+  if (!validate_ptr(rt))
     return -1;
-  if (!validate_ptr(c->group_order))
+  if (!validate_ptr(c->session))
     return -1;
-  if (assert_session_bounds(c->session) != 0)
+  struct Session* session = c->session;
+
+  if (!assert_ok(rt->group_index < session->group_count))
     return -1;
 
-  const struct Session* session = c->session;
-  size_t group_count = session->group_count;
+  size_t count = session_prompt_count(session, rt->group_index);
 
-  for (size_t i = 0; i < MAX_GROUPS; i++) {
-    if (i >= group_count)
-      break;
-    c->group_order[i] = i;
-  }
+  if (!assert_ok(count > 0))
+    return -1;
+  if (start_round(c, NULL, &rt->item_perm, count) != 0)
+    return -1;
+  rt->items_stored = 0;
+  rt->item_pos = 0;
   return 0;
 }
 
-static int init_item_order(const struct ctx* c, size_t group_index) {
+/* Sets the current group's round aside before another group is shown.
+ * A round in the stored order cannot be; the group starts over.
+ */
+static int save_group_items(const struct ctx* c, const struct runtime* rt) {
   if (!validate_ptr(c))
     return -1;
-  if (!validate_ptr(c->session))
+  if (!validate_ptr(rt))
     return -1;
-  if (!validate_ptr(c->item_order))
+  if (!assert_ok(rt->group_index < c->cursor_cap))
     return -1;
-  struct Session* session = c->session;
-  size_t group_count = session->group_count;
 
-  if (!assert_ok(group_index < group_count))
-    return -1;
+  struct PermCursor* cursor = &c->cursors[rt->group_index];
 
-  const struct Group* group = &session->groups[group_index];
-  size_t count = group->item_count;
-  size_t start = group->item_start;
+  if (rt->items_stored) {
+    memset(cursor, 0, sizeof(*cursor));
+    return 0;
+  }
+  return rng_perm_save(&rt->item_perm, rt->item_pos + 1U, cursor);
+}
 
-  if (!assert_ok(count > 0))
+/* Enters the current group: resumes its saved round over the prompts, or
+ * starts one if it has none or its prompt count changed.
+ */
+static int resume_group_items(const struct ctx* c, struct runtime* rt) {
+  if (!validate_ptr(c))
+    return -1;
+  if (!validate_ptr(rt))
     return -1;
-  if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
+  if (!assert_ok(rt->group_index < c->cursor_cap))
     return -1;
 
-  for (size_t i = 0; i < MAX_ITEMS_PER_GROUP; i++) {
-    if (i >= count)
-      break;
-    c->item_order[i] = start + i;
+  const struct PermCursor* cursor = &c->cursors[rt->group_index];
+  size_t count = session_prompt_count(c->session, rt->group_index);
+
+  if (cursor->count != count)
+    return shuffle_group_items(c, rt);
+  if (cursor->pos >= count) {
+    /* The group was left on the last prompt of its round. */
+    int rc = shuffle_group_items(c, rt);
+
+    if (rc != 0)
+      return -1;
+    return log_shuffle("items", rt->group_index);
   }
+  if (rng_perm_load(&rt->item_perm, cursor) != 0)
+    return -1;
+  rt->items_stored = 0;
+  rt->item_pos = cursor->pos;
   return 0;
 }
 
@@ -165,19 +367,15 @@ static int select_next_group(const struct ctx* c, struct runtime* rt) {
     return -1;
   if (!validate_ptr(c->rng))
     return -1;
-  if (!validate_ptr(c->group_order))
-    return -1;
 
-  const struct Session* session = c->session;
+  struct Session* session = c->session;
   size_t group_count = session->group_count;
-  size_t* group_order = c->group_order;
 
   if (!assert_ok(group_count > 0))
     return -1;
 
   if (rt->order_pos >= group_count) {
-    struct Rng* rng = c->rng;
-    int rc = rng_shuffle_groups(rng, group_order, group_count);
+    int rc = start_round(c, c->group_order, &rt->group_perm, group_count);
     if (rc != 0)
       return -1;
     rt->order_pos = 0;
@@ -185,12 +383,28 @@ static int select_next_group(const struct ctx* c, struct runtime* rt) {
     if (rc != 0)
       return -1;
   }
-  size_t order_pos = rt->order_pos;
+  u32 group = 0;
+  int rc = round_entry(c,
+      c->group_order,
+      &rt->group_perm,
+      rt->order_pos,
+      group_count,
+      &group);
 
-  rt->group_index = group_order[order_pos];
+  if (rc != 0)
+    return -1;
+  rt->group_index = group;
   if (!assert_ok(rt->group_index < group_count))
     return -1;
   rt->order_pos++;
+  if (session->lazy && session->groups[rt->group_index].item_count == 0) {
+    rc = parse_group_items(session, rt->group_index, c->err_buf, c->err_len);
+    if (rc != 0)
+      return -1;
+    rc = log_group("load", rt->group_index);
+    if (rc != 0)
+      return -1;
+  }
   return 0;
 }
 
@@ -201,7 +415,7 @@ static int select_next_item(const struct ctx* c, struct runtime* rt) {
     return -1;
   if (!validate_ptr(c->session))
     return -1;
-  if (!validate_ptr(c->item_order))
+  if (!validate_ptr(c->rng))
     return -1;
   struct Session* session = c->session;
   size_t group_count = session->group_count;
@@ -209,21 +423,21 @@ static int select_next_item(const struct ctx* c, struct runtime* rt) {
   if (!assert_ok(rt->group_index < group_count))
     return -1;
 
-  size_t group_index = rt->group_index;
-  const struct Group* group = &session->groups[group_index];
-  size_t count = group->item_count;
+  size_t count = session_prompt_count(session, rt->group_index);
 
   if (!assert_ok(count > 0))
     return -1;
-  if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
-    return -1;
 
   if (rt->item_pos >= count)
     rt->item_pos = 0;
-  size_t item_pos = rt->item_pos;
-  const size_t* item_order = c->item_order;
+  u32 prompt = 0;
+  struct ShuffleOrder* order = rt->items_stored ? c->item_order : NULL;
+  int rc =
+      round_entry(c, order, &rt->item_perm, rt->item_pos, count, &prompt);
 
-  rt->item_index = item_order[item_pos];
+  if (rc != 0)
+    return -1;
+  rt->prompt = prompt;
   return 0;
 }
 
@@ -247,18 +461,10 @@ static int update_group_timer(const struct ctx* c, struct runtime* rt) {
     return -1;
   if (!assert_ok(seconds <= MAX_GROUP_SECONDS))
     return -1;
-
-  u64 now = 0;
-  int rc = now_ms(&now);
-
-  if (rc != 0)
-    return -1;
-  rt->group_end = now + (u64)seconds * 1000ULL;
-  return 0;
+  return loop_arm_timer(c->loop, seconds);
 }
 
-static int advance_prompt(
-    const struct ctx* c, struct runtime* rt, int due_to_switch) {
+static int advance_prompt(const struct ctx* c, struct runtime* rt) {
   if (!validate_ptr(c))
     return -1;
   if (!validate_ptr(rt))
@@ -273,118 +479,98 @@ static int advance_prompt(
 
   if (!assert_ok(group_index < group_count))
     return -1;
-  const struct Group* group = &session->groups[group_index];
-  size_t count = group->item_count;
+  size_t count = session_prompt_count(session, group_index);
 
   if (!assert_ok(count > 0))
     return -1;
-  if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
-    return -1;
-
-  if (due_to_switch) {
-    int rc = init_item_order(c, rt->group_index);
-
-    if (rc != 0)
-      return -1;
-    struct Rng* rng = c->rng;
-    size_t* item_order = c->item_order;
 
-    rc = rng_shuffle_items(rng, item_order, count);
+  rt->item_pos++;
+  if (rt->item_pos >= count) {
+    int rc = shuffle_group_items(c, rt);
     if (rc != 0)
       return -1;
-    rt->item_pos = 0;
-    rc = update_group_timer(c, rt);
+    rc = log_shuffle("items", rt->group_index);
     if (rc != 0)
       return -1;
-    rc = log_group("group", rt->group_index);
-    if (rc != 0)
-      return -1;
-  } else {
-    rt->item_pos++;
-    if (rt->item_pos >= count) {
-      struct Rng* rng = c->rng;
-      size_t* item_order = c->item_order;
-      int rc = rng_shuffle_items(rng, item_order, count);
-      if (rc != 0)
-        return -1;
-      rt->item_pos = 0;
-      rc = log_shuffle("items", rt->group_index);
-      if (rc != 0)
-        return -1;
-    }
   }
 
   int rc = select_next_item(c, rt);
 
   if (rc != 0)
     return -1;
-  size_t item_index = rt->item_index;
+  return show_prompt(c, rt);
+}
+
+/* Draws the next group (loading it if lazy), resumes or starts its round
+ * and renders its next prompt, without touching the screen or the timer.
+ */
+static int prepare_switch(const struct ctx* c, struct runtime* rt) {
+  if (!validate_ptr(c))
+    return -1;
+  if (!validate_ptr(rt))
+    return -1;
+
+  int rc = select_next_group(c, rt);
 
-  rc = draw_prompt(session, item_index);
   if (rc != 0)
     return -1;
-  rc = log_prompt(session, group_index, item_index);
+  rc = resume_group_items(c, rt);
+  if (rc != 0)
+    return -1;
+  rc = select_next_item(c, rt);
+  if (rc != 0)
+    return -1;
+  rc = build_frame(c, rt, rt->group_index, rt->prompt);
   if (rc != 0)
     return -1;
+  rt->next_ready = 1;
   return 0;
 }
 
-static int update_expiry(
-    const struct ctx* c, struct runtime* rt, u64* remaining_ms) {
+/* Sets the expired group's round aside and prepares the next group. */
+static int leave_group(const struct ctx* c, struct runtime* rt) {
+  int rc = save_group_items(c, rt);
+
+  if (rc != 0)
+    return -1;
+  return prepare_switch(c, rt);
+}
+
+/* Shows the prepared group: starts its timer and draws its prompt. */
+static int finish_switch(const struct ctx* c, struct runtime* rt) {
   if (!validate_ptr(c))
     return -1;
   if (!validate_ptr(rt))
     return -1;
-  if (!validate_ptr(remaining_ms))
-    return -1;
-  if (!validate_ptr(c->session))
-    return -1;
-  const struct Session* session = c->session;
-  size_t group_count = session->group_count;
-  size_t group_index = rt->group_index;
-
-  if (!assert_ok(group_index < group_count))
+  if (!assert_ok(rt->next_ready))
     return -1;
 
-  *remaining_ms = 0;
-  if (rt->pending_switch)
-    return 0;
+  rt->pending_switch = 0;
+  rt->next_ready = 0;
 
-  u64 now = 0;
-  int rc = now_ms(&now);
+  int rc = update_group_timer(c, rt);
 
   if (rc != 0)
     return -1;
-  if (now >= rt->group_end) {
-    rt->pending_switch = 1;
-    rc = log_group("expired", rt->group_index);
-    if (rc != 0)
-      return -1;
-    return 0;
-  }
-  *remaining_ms = rt->group_end - now;
-  return 0;
+  rc = log_group("group", rt->group_index);
+  if (rc != 0)
+    return -1;
+  rc = put_frame(rt);
+  if (rc != 0)
+    return -1;
+  return log_frame(c, rt);
 }
 
-static int read_key(const struct ctx* c,
-    const struct runtime* rt,
-    u64 remaining_ms,
-    int* key_out) {
+static int handle_expiry(const struct ctx* c, struct runtime* rt) {
   if (!validate_ptr(c))
     return -1;
   if (!validate_ptr(rt))
     return -1;
-  if (!validate_ptr(key_out))
+  if (!assert_ok(!rt->pending_switch))
     return -1;
-  if (!validate_ok(remaining_ms <= MAX_GROUP_MILLISECONDS))
-    return -1;
-
-  int timeout = rt->pending_switch ? -1 : (int)remaining_ms;
-  int rc = term_read_key_timeout(timeout, key_out);
 
-  if (rc < 0)
-    return -1;
-  return rc;
+  rt->pending_switch = 1;
+  return log_group("expired", rt->group_index);
 }
 
 static int handle_key(
@@ -406,15 +592,13 @@ static int handle_key(
     return 0;
 
   if (rt->pending_switch) {
-    rc = select_next_group(c, rt);
-    if (rc != 0)
+    if (!rt->next_ready && leave_group(c, rt) != 0)
       return -1;
-    rt->pending_switch = 0;
-    rc = advance_prompt(c, rt, 1);
+    rc = finish_switch(c, rt);
     if (rc != 0)
       return -1;
   } else {
-    rc = advance_prompt(c, rt, 0);
+    rc = advance_prompt(c, rt);
     if (rc != 0)
       return -1;
   }
@@ -422,6 +606,253 @@ static int handle_key(
   return 0;
 }
 
+/* Renumbers an order after a reload. Survivors keep their relative
+ * order, added entries go to the end of the round, and *pos moves to the
+ * first surviving entry at or after it. Used for both the group and the
+ * item order.
+ */
+static size_t remap_order(struct ShuffleOrder* order,
+    size_t* pos,
+    const struct ReloadSpan* span,
+    size_t old_base,
+    size_t new_base) {
+  size_t kept = 0;
+  size_t new_pos = 0;
+
+  for (size_t i = 0; i < ORDER_MAX_ENTRIES; i++) {
+    if (i >= span->old_count)
+      break;
+    size_t n = 0;
+
+    if (reload_index(span, rng_order_at(order, i) - old_base, &n) != 0)
+      continue;
+    if (i < *pos)
+      new_pos++;
+    (void)rng_order_put(order, kept++, (u32)(new_base + n));
+  }
+  for (size_t i = span->head; i < ORDER_MAX_ENTRIES; i++) {
+    if (i + span->tail >= span->new_count)
+      break;
+    (void)rng_order_put(order, kept++, (u32)(new_base + i));
+  }
+  *pos = new_pos;
+  return kept;
+}
+
+/* Moves the saved rounds along with their groups after a reload. The
+ * re-parsed groups between the unchanged head and tail start over.
+ */
+static int remap_cursors(const struct ctx* c, const struct ReloadSpan* span) {
+  size_t head = span->head;
+  size_t tail = span->tail;
+
+  if (!assert_ok(span->new_count <= c->cursor_cap))
+    return -1;
+  if (!assert_ok(head + tail <= span->old_count))
+    return -1;
+  if (!assert_ok(head + tail <= span->new_count))
+    return -1;
+
+  struct PermCursor* cursors = c->cursors;
+
+  memmove(cursors + span->new_count - tail,
+      cursors + span->old_count - tail,
+      tail * sizeof(cursors[0]));
+  memset(cursors + head,
+      0,
+      (span->new_count - tail - head) * sizeof(cursors[0]));
+  return 0;
+}
+
+/* Copies the current round over the prompts into the stored item order,
+ * so a reload can renumber it.
+ */
+static int store_group_items(const struct ctx* c, struct runtime* rt) {
+  size_t count = rt->item_perm.count;
+
+  if (!assert_ok(count <= c->item_order->cap))
+    return -1;
+  if (rng_order_reset(c->item_order) != 0)
+    return -1;
+  for (size_t i = 0; i < ORDER_MAX_ENTRIES; i++) {
+    if (i >= count)
+      break;
+    u32 value = rng_perm_at(&rt->item_perm, i);
+
+    if (rng_order_put(c->item_order, i, value) != 0)
+      return -1;
+  }
+  rt->items_stored = 1;
+  return 0;
+}
+
+/* Shows the prompt in rt after a reload. A prepared group is not on
+ * screen yet; handle_events renders its prompt again instead.
+ */
+static int present_prompt(const struct ctx* c, struct runtime* rt) {
+  if (!validate_ptr(rt))
+    return -1;
+
+  if (rt->next_ready)
+    return 0;
+  return show_prompt(c, rt);
+}
+
+static int apply_reload(const struct ctx* c, struct runtime* rt) {
+  struct Session* session = c->session;
+  const struct ReloadMap* map = c->reload;
+  (void)remap_order(c->group_order, &rt->order_pos, &map->groups, 0, 0);
+  if (remap_cursors(c, &map->groups) != 0)
+    return -1;
+  if (!map->group_kept) {
+    /* The current group is gone; move on as if it had expired, or
+     * prepare another one if the switch is still waiting for a key.
+     */
+    int rc = prepare_switch(c, rt);
+
+    if (rc != 0)
+      return -1;
+    if (rt->pending_switch)
+      return 0;
+    return finish_switch(c, rt);
+  }
+  rt->group_index = map->group_new;
+
+  int was_generated = map->saved_groups[map->group].expand != 0;
+  int is_generated = session->groups[rt->group_index].expand != 0;
+  size_t n = 0;
+
+  if (was_generated || is_generated) {
+    /* Generated prompts follow their line: an unchanged generator keeps
+     * its round, anything else starts a new one.
+     */
+    if (was_generated && is_generated &&
+        reload_index(&map->items, 0, &n) == 0)
+      return 0;
+
+    int rc = shuffle_group_items(c, rt);
+
+    if (rc != 0)
+      return -1;
+    rc = select_next_item(c, rt);
+    if (rc != 0)
+      return -1;
+    return present_prompt(c, rt);
+  }
+
+  const struct ReloadSpan* items = &map->items;
+
+  if (!rt->items_stored) {
+    /* Unchanged prompts keep their numbers and the round its order. */
+    if (items->old_count == items->new_count &&
+        items->head + items->tail >= items->old_count)
+      return 0;
+    if (store_group_items(c, rt) != 0)
+      return -1;
+  }
+
+  size_t count = remap_order(c->item_order, &rt->item_pos, items, 0, 0);
+
+  if (!assert_ok(count == items->new_count))
+    return -1;
+  if (reload_index(items, rt->prompt, &n) == 0) {
+    rt->prompt = n;
+    return 0;
+  }
+
+  /* The prompt on screen was edited or removed; show the next one. */
+  int rc = select_next_item(c, rt);
+
+  if (rc != 0)
+    return -1;
+  return present_prompt(c, rt);
+}
+
+static int handle_reload(const struct ctx* c, struct runtime* rt) {
+  if (!validate_ptr(c))
+    return -1;
+  if (!validate_ptr(rt))
+    return -1;
+  if (!validate_ptr(c->watch))
+    return -1;
+  if (!validate_ptr(c->reload))
+    return -1;
+  if (!validate_ptr(c->group_order))
+    return -1;
+  if (!validate_ptr(c->item_order))
+    return -1;
+
+  int changed = 0;
+  int rc = watch_drain(c->watch, &changed);
+
+  if (rc != 0)
+    return -1;
+  if (!changed)
+    return 0;
+  c->reload->group = rt->group_index;
+  rc = parse_session_reload(
+      c->session, c->watch->path, c->reload, c->err_buf, c->err_len);
+  if (rc != 0) {
+    /* Keep drilling on the previous deck until the file is fixed. */
+    rc = log_simple("reload", c->err_buf);
+    c->err_buf[0] = '\0';
+    return rc;
+  }
+  /* Prompts may have been edited or renumbered under the built frame. */
+  rt->frame_ready = 0;
+  rc = apply_reload(c, rt);
+  if (rc != 0)
+    return -1;
+  return log_reload(c->session, c->reload);
+}
+
+/* Handles what one wakeup brought, other than keys: the timer first,
+ * as a key typed after expiry switches groups. Returns 1 on a quit
+ * signal.
+ */
+static int handle_events(const struct ctx* c, struct runtime* rt) {
+  const struct LoopEvents* ev = &rt->events;
+
+  if (ev->quit) {
+    int rc = log_simple("signal", "quit");
+
+    if (rc != 0)
+      return -1;
+    return 1;
+  }
+  if (ev->writable && term_flush(&g_screen) != 0)
+    return -1;
+  if (ev->expired && !rt->pending_switch && handle_expiry(c, rt) != 0)
+    return -1;
+  if (ev->changed && handle_reload(c, rt) != 0)
+    return -1;
+  /* The screen redraws what it shows, or what waits to be shown; while a
+   * switch is prepared that is still the expired group's prompt.
+   */
+  if (ev->resized && term_screen_resize(&g_screen) != 0)
+    return -1;
+  /* Output sent, a reload or a resize leave a prepared switch's frame
+   * stale; rebuild it before the keys of this wakeup, so the switch key
+   * only writes it.
+   */
+  if (rt->next_ready)
+    return build_frame(c, rt, rt->group_index, rt->prompt);
+  return 0;
+}
+
+/* Index of the last key of a batch that advances; 0 if none does. */
+static size_t last_advance_key(const struct LoopEvents* ev) {
+  size_t last = 0;
+
+  for (size_t i = 0; i < LOOP_KEY_BATCH; i++) {
+    if (i >= ev->key_count)
+      break;
+    if (is_advance_key((int)ev->keys[i]))
+      last = i;
+  }
+  return last;
+}
+
 static int run_wait_loop(
     const struct ctx* c, struct runtime* rt, int* advanced) {
   if (!validate_ptr(c))
@@ -432,24 +863,47 @@ static int run_wait_loop(
     return -1;
 
   for (size_t wait = 0; wait < MAX_WAIT_LOOPS; wait++) {
-    u64 remaining_ms = 0;
-    int rc = update_expiry(c, rt, &remaining_ms);
+    int rc = 0;
+
+    /* Nothing changes on screen until a key is pressed, so do the work
+     * of the switch now rather than after that key.
+     */
+    if (rt->pending_switch && !rt->next_ready) {
+      rc = leave_group(c, rt);
+      if (rc != 0)
+        return -1;
+    }
+    if (rt->key_pos < rt->events.key_count) {
+      int key = (int)rt->events.keys[rt->key_pos];
+      int key_rc = 0;
 
+      rt->skip_draw = rt->key_pos < rt->last_advance;
+      rt->key_pos++;
+      key_rc = handle_key(c, rt, key, advanced);
+      rt->skip_draw = 0;
+
+      if (key_rc < 0)
+        return -1;
+      if (key_rc > 0 || *advanced)
+        return key_rc;
+      continue;
+    }
+    rc = prepare_frame(c, rt);
     if (rc != 0)
       return -1;
-    int key = 0;
-
-    rc = read_key(c, rt, remaining_ms, &key);
-    if (rc < 0)
+    rc = loop_watch_output(c->loop,
+        term_output_fd(&g_screen),
+        term_output_pending(&g_screen));
+    if (rc != 0)
       return -1;
-    if (rc == 0)
-      continue;
-    int key_rc = handle_key(c, rt, key, advanced);
-
-    if (key_rc < 0)
+    rc = loop_wait(c->loop, &rt->events);
+    if (rc != 0)
       return -1;
-    if (key_rc > 0 || *advanced)
-      return key_rc;
+    rt->key_pos = 0;
+    rt->last_advance = last_advance_key(&rt->events);
+    rc = handle_events(c, rt);
+    if (rc != 0)
+      return rc;
   }
   return -1;
 }
@@ -505,50 +959,34 @@ static int init_runtime(const struct ctx* c, struct runtime* rt) {
   rt->order_pos = 0;
   rt->group_index = 0;
   rt->item_pos = 0;
-  rt->item_index = 0;
-  rt->group_end = 0;
+  rt->prompt = 0;
   rt->pending_switch = 0;
-
-  int rc = init_group_order(c);
+  rt->items_stored = 0;
+  rt->events.key_count = 0;
+  rt->key_pos = 0;
+  rt->last_advance = 0;
+  rt->skip_draw = 0;
+  rt->skipped = 0;
+  rt->next_ready = 0;
+  rt->frame_ready = 0;
+  rt->frame_group = 0;
+  rt->frame_prompt = 0;
+  rt->frame_decode_ns = 0;
+
+  int rc = start_round(c, c->group_order, &rt->group_perm, group_count);
 
-  if (rc != 0)
-    return -1;
-  struct Rng* rng = c->rng;
-  size_t* group_order = c->group_order;
-
-  rc = rng_shuffle_groups(rng, group_order, group_count);
   if (rc != 0)
     return -1;
   rc = select_next_group(c, rt);
   if (rc != 0)
     return -1;
-  rc = init_item_order(c, rt->group_index);
-  if (rc != 0)
-    return -1;
-
-  size_t group_index = rt->group_index;
-  const struct Group* group = &session->groups[group_index];
-  size_t count = group->item_count;
-
-  if (!assert_ok(count > 0))
-    return -1;
-  if (!assert_ok(count <= MAX_ITEMS_PER_GROUP))
-    return -1;
-  struct Rng* item_rng = c->rng;
-  size_t* item_order = c->item_order;
-
-  rc = rng_shuffle_items(item_rng, item_order, count);
+  rc = shuffle_group_items(c, rt);
   if (rc != 0)
     return -1;
   rc = select_next_item(c, rt);
   if (rc != 0)
     return -1;
-  size_t item_index = rt->item_index;
-
-  rc = draw_prompt(session, item_index);
-  if (rc != 0)
-    return -1;
-  rc = log_prompt(session, group_index, item_index);
+  rc = show_prompt(c, rt);
   if (rc != 0)
     return -1;
   rc = update_group_timer(c, rt);
@@ -560,8 +998,11 @@ static int init_runtime(const struct ctx* c, struct runtime* rt) {
 int runner_run(const struct TermState* term,
     struct Session* session,
     struct Rng* rng,
-    size_t* group_order,
-    size_t* item_order) {
+    struct RunOrders* orders,
+    struct Watch* watch,
+    struct ReloadMap* reload,
+    char* err_buf,
+    size_t err_len) {
   if (!validate_ptr(term))
     return -1;
   if (!assert_ok(term->active == 1))
@@ -572,23 +1013,54 @@ int runner_run(const struct TermState* term,
     return -1;
   if (!validate_ptr(rng))
     return -1;
-  if (!validate_ptr(group_order))
+  if (!validate_ptr(orders))
+    return -1;
+  if (!validate_ptr(orders->cursors))
+    return -1;
+  if (!validate_ok(orders->cursor_cap >= session->group_count))
+    return -1;
+  if (!validate_ok(!orders->groups.values == !orders->items.values))
     return -1;
-  if (!validate_ptr(item_order))
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (!validate_ok(!watch || (reload && orders->groups.values)))
     return -1;
 
+  struct EventLoop loop;
   struct ctx c = {
     .session = session,
     .rng = rng,
-    .group_order = group_order,
-    .item_order = item_order,
+    .cursors = orders->cursors,
+    .cursor_cap = orders->cursor_cap,
+    .group_order = orders->groups.values ? &orders->groups : NULL,
+    .item_order = orders->items.values ? &orders->items : NULL,
+    .err_buf = err_buf,
+    .err_len = err_len,
+    .watch = watch,
+    .reload = reload,
+    .loop = &loop,
   };
-  struct runtime rt;
-  int rc = init_runtime(&c, &rt);
+  int rc = loop_open(&loop, watch ? watch->fd : -1, err_buf, err_len);
 
   if (rc != 0)
     return -1;
-  rc = run_loop(&c, &rt);
+
+  struct runtime rt;
+
+  rc = term_screen_open(&g_screen);
+  if (rc == 0) {
+    rc = init_runtime(&c, &rt);
+    if (rc == 0)
+      rc = run_loop(&c, &rt);
+    if (term_screen_close(&g_screen) != 0)
+      rc = -1;
+    if (rc == 0)
+      rc = log_draw(&g_screen);
+  }
+  if (loop_close(&loop) != 0)
+    return -1;
   if (rc != 0)
     return -1;
   return 0;
@@ -0,0 +1,712 @@
+// SPDX-License-Identifier: MIT
+#include "scan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRAM_SCAN_X86 1
+#include <immintrin.h>
+#else
+#define CRAM_SCAN_X86 0
+#endif
+
+#define SCAN_BLOCK 64U
+/* UTF-8 is checked every this many bytes of lines split, while they are
+ * still in L1.
+ */
+#define SCAN_CHECK_BYTES 16384U
+#define SCAN_NONE SIZE_MAX
+
+static int g_scan_detected = 0;
+static enum scan_level g_scan_level = SCAN_SCALAR;
+static enum scan_level g_scan_limit = SCAN_AVX2;
+
+static size_t lowest_bit(u64 mask) {
+#if defined(__GNUC__)
+  return (size_t)__builtin_ctzll(mask);
+#else
+  for (size_t i = 0; i < SCAN_BLOCK; i++) {
+    if (mask & (1ULL << i))
+      return i;
+  }
+  return SCAN_BLOCK;
+#endif
+}
+
+static void masks_scalar(const char* p, size_t avail, u64* nl, u64* nonws) {
+  u64 a = 0;
+  u64 b = 0;
+
+  for (size_t i = 0; i < SCAN_BLOCK; i++) {
+    if (i >= avail)
+      break;
+    unsigned char ch = (unsigned char)p[i];
+
+    if (ch == '\n')
+      a |= 1ULL << i;
+    if (!scan_is_space(ch))
+      b |= 1ULL << i;
+  }
+  *nl = a;
+  *nonws = b;
+}
+
+#if CRAM_SCAN_X86
+static void masks_sse2(const char* p, u64* nl, u64* nonws) {
+  const __m128i v_nl = _mm_set1_epi8('\n');
+  const __m128i v_sp = _mm_set1_epi8(' ');
+  const __m128i v_tab = _mm_set1_epi8('\t');
+  const __m128i v_span = _mm_set1_epi8('\r' - '\t');
+  u64 a = 0;
+  u64 b = 0;
+
+  for (unsigned k = 0; k < SCAN_BLOCK / 16U; k++) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(const void*)(p + 16U * k));
+    /* '\t'..'\r' as one unsigned range check, plus ' '. */
+    __m128i t = _mm_sub_epi8(x, v_tab);
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, v_span), t);
+    __m128i ws = _mm_or_si128(ctl, _mm_cmpeq_epi8(x, v_sp));
+    u32 m_nl = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(x, v_nl));
+    u32 m_ws = (u32)_mm_movemask_epi8(ws);
+
+    a |= (u64)m_nl << (16U * k);
+    b |= (u64)(~m_ws & 0xFFFFU) << (16U * k);
+  }
+  *nl = a;
+  *nonws = b;
+}
+
+__attribute__((target("avx2"))) static void masks_avx2(
+    const char* p, u64* nl, u64* nonws) {
+  const __m256i v_nl = _mm256_set1_epi8('\n');
+  const __m256i v_sp = _mm256_set1_epi8(' ');
+  const __m256i v_tab = _mm256_set1_epi8('\t');
+  const __m256i v_span = _mm256_set1_epi8('\r' - '\t');
+  u64 a = 0;
+  u64 b = 0;
+
+  for (unsigned k = 0; k < SCAN_BLOCK / 32U; k++) {
+    __m256i x =
+        _mm256_loadu_si256((const __m256i*)(const void*)(p + 32U * k));
+    __m256i t = _mm256_sub_epi8(x, v_tab);
+    __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, v_span), t);
+    __m256i ws = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(x, v_sp));
+    u32 m_nl = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, v_nl));
+    u32 m_ws = (u32)_mm256_movemask_epi8(ws);
+
+    a |= (u64)m_nl << (32U * k);
+    b |= (u64)(u32)~m_ws << (32U * k);
+  }
+  *nl = a;
+  *nonws = b;
+}
+#endif
+
+/* Newline and non-space bitmasks for up to SCAN_BLOCK bytes at `p`.
+ * Short tails take the scalar path so nothing past the text is read.
+ */
+static void block_masks(enum scan_level level,
+    const char* p,
+    size_t avail,
+    u64* nl,
+    u64* nonws) {
+  if (avail < SCAN_BLOCK) {
+    masks_scalar(p, avail, nl, nonws);
+    return;
+  }
+  switch (level) {
+#if CRAM_SCAN_X86
+    case SCAN_AVX2:
+      masks_avx2(p, nl, nonws);
+      return;
+    case SCAN_SSE2:
+      masks_sse2(p, nl, nonws);
+      return;
+#endif
+    default:
+      masks_scalar(p, avail, nl, nonws);
+      return;
+  }
+}
+
+/* Bytes in the valid UTF-8 sequence at s[i] (1-4), or 0 if there is
+ * none: bad lead bytes, overlong forms, surrogates, code points past
+ * U+10FFFF and sequences cut short by the end of the text.
+ */
+static size_t utf8_sequence(const unsigned char* s, size_t len, size_t i) {
+  unsigned char c = s[i];
+  unsigned char lo = 0x80U;
+  unsigned char hi = 0xBFU;
+  size_t n = 0;
+
+  if (c < 0x80U)
+    return 1;
+  if (c < 0xC2U)
+    return 0;
+  if (c < 0xE0U) {
+    n = 2;
+  } else if (c < 0xF0U) {
+    n = 3;
+    lo = (c == 0xE0U) ? 0xA0U : 0x80U;
+    hi = (c == 0xEDU) ? 0x9FU : 0xBFU;
+  } else if (c < 0xF5U) {
+    n = 4;
+    lo = (c == 0xF0U) ? 0x90U : 0x80U;
+    hi = (c == 0xF4U) ? 0x8FU : 0xBFU;
+  } else {
+    return 0;
+  }
+  if (n > len - i)
+    return 0;
+  if (s[i + 1] < lo || s[i + 1] > hi)
+    return 0;
+  for (size_t k = 2; k < 4U; k++) {
+    if (k >= n)
+      break;
+    if ((s[i + k] & 0xC0U) != 0x80U)
+      return 0;
+  }
+  return n;
+}
+
+/* Validates the sequences that start in s[pos, end), from s[pos], which
+ * must start one; 8 ASCII bytes are checked at a time. Returns where the
+ * first invalid one starts, or else where the next one does (`end`, or
+ * past it if a sequence crosses it).
+ */
+static size_t utf8_scalar(
+    const unsigned char* s, size_t len, size_t pos, size_t end) {
+  size_t i = pos;
+
+  for (u64 iter = 0; iter <= MAX_DECK_BYTES; iter++) {
+    if (i >= end)
+      break;
+    if (len - i >= 8U) {
+      u64 word = 0;
+
+      memcpy(&word, s + i, sizeof(word));
+      if ((word & 0x8080808080808080ULL) == 0) {
+        i += 8U;
+        continue;
+      }
+    }
+    size_t n = utf8_sequence(s, len, i);
+
+    if (n == 0)
+      return i;
+    i += n;
+  }
+  return i;
+}
+
+/* Start of the sequence that the bytes before s[base] end with, if it may
+ * continue past base; base otherwise. Everything before base is valid.
+ */
+static size_t utf8_boundary(const unsigned char* s, size_t base) {
+  for (size_t j = 1; j <= 3U; j++) {
+    if (j > base)
+      break;
+    if ((s[base - j] & 0xC0U) != 0x80U)
+      return base - j;
+  }
+  return base;
+}
+
+#if CRAM_SCAN_X86
+/* Bytes of `x` at or above `byte` (0x80 or more), as a 16-bit mask;
+ * `bias` is x ^ 0x80, on which a signed compare orders bytes unsigned.
+ */
+static inline u64 u8_at_least(__m128i bias, unsigned char byte) {
+  __m128i t = _mm_set1_epi8((char)(signed char)(byte - 0x81U));
+
+  return (u64)(u32)_mm_movemask_epi8(_mm_cmpgt_epi8(bias, t));
+}
+
+static inline u64 u8_equal(__m128i x, unsigned char byte) {
+  __m128i eq = _mm_cmpeq_epi8(x, _mm_set1_epi8((char)byte));
+
+  return (u64)(u32)_mm_movemask_epi8(eq);
+}
+
+/* Checks the SCAN_BLOCK bytes at s[i], which starts a sequence, with one
+ * bitmask per byte class: the leads mark the continuation bytes their
+ * sequences need, and those must be exactly the continuation bytes there
+ * are. Returns how many bytes are valid up to a sequence the block ends
+ * in the middle of, or 0 if it may hold an invalid one.
+ */
+static size_t utf8_block_sse2(const unsigned char* s, size_t i) {
+  const __m128i* p = (const __m128i*)(const void*)(s + i);
+  __m128i x[SCAN_BLOCK / 16U] = {_mm_loadu_si128(p),
+      _mm_loadu_si128(p + 1),
+      _mm_loadu_si128(p + 2),
+      _mm_loadu_si128(p + 3)};
+  __m128i any =
+      _mm_or_si128(_mm_or_si128(x[0], x[1]), _mm_or_si128(x[2], x[3]));
+
+  if (_mm_movemask_epi8(any) == 0)
+    return SCAN_BLOCK;
+
+  u64 high = 0;
+  u64 ge_c0 = 0;
+  u64 ge_c2 = 0;
+  u64 ge_e0 = 0;
+  u64 ge_f0 = 0;
+  u64 ge_f5 = 0;
+
+  for (unsigned k = 0; k < SCAN_BLOCK / 16U; k++) {
+    unsigned shift = 16U * k;
+    __m128i bias = _mm_xor_si128(x[k], _mm_set1_epi8((char)0x80));
+
+    high |= (u64)(u32)_mm_movemask_epi8(x[k]) << shift;
+    ge_c0 |= u8_at_least(bias, 0xC0U) << shift;
+    ge_c2 |= u8_at_least(bias, 0xC2U) << shift;
+    ge_e0 |= u8_at_least(bias, 0xE0U) << shift;
+    ge_f0 |= u8_at_least(bias, 0xF0U) << shift;
+    ge_f5 |= u8_at_least(bias, 0xF5U) << shift;
+  }
+
+  u64 cont = high & ~ge_c0;
+  u64 lead = ge_c2 & ~ge_f5;
+  u64 lead3 = ge_e0 & ~ge_f5;
+  u64 lead4 = ge_f0 & ~ge_f5;
+  u64 want = (lead << 1) | (lead3 << 2) | (lead4 << 3);
+  /* C0, C1 and F5-FF, and continuation bytes where no lead wants one or
+   * the other way round.
+   */
+  u64 bad = (ge_c0 & ~ge_c2) | ge_f5 | (want ^ cont);
+
+  if (bad != 0)
+    return 0;
+
+  /* A sequence cut by the end of the block is left for the next one. */
+  size_t valid = SCAN_BLOCK;
+
+  if ((lead >> 63) | (lead3 >> 62) | (lead4 >> 61))
+    valid = 63U - (size_t)__builtin_clzll(lead);
+
+  __m128i limited = _mm_setzero_si128();
+
+  for (unsigned k = 0; k < SCAN_BLOCK / 16U; k++) {
+    __m128i e = _mm_or_si128(_mm_cmpeq_epi8(x[k], _mm_set1_epi8((char)0xE0)),
+        _mm_cmpeq_epi8(x[k], _mm_set1_epi8((char)0xED)));
+    __m128i f = _mm_or_si128(_mm_cmpeq_epi8(x[k], _mm_set1_epi8((char)0xF0)),
+        _mm_cmpeq_epi8(x[k], _mm_set1_epi8((char)0xF4)));
+
+    limited = _mm_or_si128(limited, _mm_or_si128(e, f));
+  }
+  if (_mm_movemask_epi8(limited) == 0)
+    return valid;
+
+  /* Second bytes of E0, ED, F0 and F4: overlong forms, surrogates and
+   * code points past U+10FFFF.
+   */
+  u64 ge_90 = 0;
+  u64 ge_a0 = 0;
+  u64 e0 = 0;
+  u64 ed = 0;
+  u64 f0 = 0;
+  u64 f4 = 0;
+
+  for (unsigned k = 0; k < SCAN_BLOCK / 16U; k++) {
+    unsigned shift = 16U * k;
+    __m128i bias = _mm_xor_si128(x[k], _mm_set1_epi8((char)0x80));
+
+    ge_90 |= u8_at_least(bias, 0x90U) << shift;
+    ge_a0 |= u8_at_least(bias, 0xA0U) << shift;
+    e0 |= u8_equal(x[k], 0xE0U) << shift;
+    ed |= u8_equal(x[k], 0xEDU) << shift;
+    f0 |= u8_equal(x[k], 0xF0U) << shift;
+    f4 |= u8_equal(x[k], 0xF4U) << shift;
+  }
+  bad = ((e0 << 1) & ~ge_a0) | ((ed << 1) & ge_a0) | ((f0 << 1) & ~ge_90) |
+        ((f4 << 1) & ge_90);
+  return (bad == 0) ? valid : 0;
+}
+
+/* Checks SCAN_BLOCK bytes at a time with masks and steps through the
+ * sequences of a block they fail.
+ */
+static size_t utf8_sse2(const unsigned char* s, size_t len) {
+  size_t i = 0;
+
+  for (u64 iter = 0; iter <= MAX_DECK_BYTES / (SCAN_BLOCK - 3U); iter++) {
+    if (len - i < SCAN_BLOCK)
+      break;
+    size_t valid = utf8_block_sse2(s, i);
+
+    if (valid > 0) {
+      i += valid;
+      continue;
+    }
+    size_t end = i + SCAN_BLOCK;
+
+    i = utf8_scalar(s, len, i, end);
+    if (i < end)
+      return i;
+  }
+  return utf8_scalar(s, len, i, len);
+}
+
+/* Error classes of a byte pair, after simdjson's UTF-8 lookup algorithm
+ * (Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+ * Byte"): the classes the first byte's high and low nibbles and the second
+ * byte's high nibble allow are ANDed, and any class left is an error.
+ */
+#define U8_TOO_SHORT 0x01
+#define U8_TOO_LONG 0x02
+#define U8_OVERLONG_3 0x04
+#define U8_TOO_LARGE 0x08
+#define U8_SURROGATE 0x10
+#define U8_OVERLONG_2 0x20
+#define U8_TOO_LARGE_1000 0x40
+#define U8_OVERLONG_4 0x40
+#define U8_TWO_CONTS 0x80
+#define U8_CARRY (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+/* The bytes n before each byte of `x`, reaching back into `prev`. */
+__attribute__((target("avx2"))) static inline __m256i u8_prev(
+    __m256i x, __m256i prev, int n) {
+  __m256i cross = _mm256_permute2x128_si256(prev, x, 0x21);
+
+  switch (n) {
+    case 1:
+      return _mm256_alignr_epi8(x, cross, 15);
+    case 2:
+      return _mm256_alignr_epi8(x, cross, 14);
+    default:
+      return _mm256_alignr_epi8(x, cross, 13);
+  }
+}
+
+static const unsigned char u8_byte_1_high[16] = {
+    /* 0___: ASCII, 10__: continuation, then 2-, 3- and 4-byte leads. */
+    U8_TOO_LONG,
+    U8_TOO_LONG,
+    U8_TOO_LONG,
+    U8_TOO_LONG,
+    U8_TOO_LONG,
+    U8_TOO_LONG,
+    U8_TOO_LONG,
+    U8_TOO_LONG,
+    U8_TWO_CONTS,
+    U8_TWO_CONTS,
+    U8_TWO_CONTS,
+    U8_TWO_CONTS,
+    U8_TOO_SHORT | U8_OVERLONG_2,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+    U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+};
+
+static const unsigned char u8_byte_1_low[16] = {
+    U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+    U8_CARRY | U8_OVERLONG_2,
+    U8_CARRY,
+    U8_CARRY,
+    U8_CARRY | U8_TOO_LARGE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+};
+
+static const unsigned char u8_byte_2_high[16] = {
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 |
+        U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 |
+        U8_TOO_LARGE,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE |
+        U8_TOO_LARGE,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE |
+        U8_TOO_LARGE,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT,
+};
+
+/* A 16-entry table in both lanes, for _mm256_shuffle_epi8. */
+__attribute__((target("avx2"))) static inline __m256i u8_table(
+    const unsigned char* table) {
+  __m128i t = _mm_loadu_si128((const __m128i*)(const void*)table);
+
+  return _mm256_broadcastsi128_si256(t);
+}
+
+/* Non-zero bytes where the block `x`, following `prev`, is not valid. */
+__attribute__((target("avx2"))) static inline __m256i u8_block_errors(
+    __m256i x, __m256i prev) {
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i byte_1_high = u8_table(u8_byte_1_high);
+  const __m256i byte_1_low = u8_table(u8_byte_1_low);
+  const __m256i byte_2_high = u8_table(u8_byte_2_high);
+  __m256i prev1 = u8_prev(x, prev, 1);
+  __m256i hi1 = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble);
+  __m256i lo1 = _mm256_and_si256(prev1, nibble);
+  __m256i hi2 = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+  __m256i special = _mm256_and_si256(
+      _mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, hi1),
+          _mm256_shuffle_epi8(byte_1_low, lo1)),
+      _mm256_shuffle_epi8(byte_2_high, hi2));
+  /* Third and fourth bytes of 3- and 4-byte sequences must be
+   * continuations; TWO_CONTS above flags exactly the continuations that
+   * are not.
+   */
+  __m256i third =
+      _mm256_subs_epu8(u8_prev(x, prev, 2), _mm256_set1_epi8(0x60));
+  __m256i fourth = _mm256_subs_epu8(
+      u8_prev(x, prev, 3), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+  __m256i must23 = _mm256_and_si256(
+      _mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+
+  return _mm256_xor_si256(must23, special);
+}
+
+/* Checks SCAN_BLOCK bytes per step with the lookup algorithm. The scalar
+ * pass then finds the exact offset of an error and checks the tail,
+ * starting from the sequence the last good block ends in.
+ */
+__attribute__((target("avx2"))) static size_t utf8_avx2(
+    const unsigned char* s, size_t len) {
+  __m256i prev = _mm256_setzero_si256();
+  size_t i = 0;
+
+  for (u64 iter = 0; iter <= MAX_DECK_BYTES / SCAN_BLOCK; iter++) {
+    if (len - i < SCAN_BLOCK)
+      break;
+    __m256i x0 = _mm256_loadu_si256((const __m256i*)(const void*)(s + i));
+    __m256i x1 =
+        _mm256_loadu_si256((const __m256i*)(const void*)(s + i + 32U));
+
+    /* ASCII after ASCII holds no error. Testing `prev` first keeps the
+     * branch predictable in text that is mostly not ASCII.
+     */
+    if (_mm256_movemask_epi8(prev) != 0 ||
+        _mm256_movemask_epi8(_mm256_or_si256(x0, x1)) != 0) {
+      __m256i err = _mm256_or_si256(
+          u8_block_errors(x0, prev), u8_block_errors(x1, x0));
+
+      if (!_mm256_testz_si256(err, err))
+        break;
+    }
+    prev = x1;
+    i += SCAN_BLOCK;
+  }
+  return utf8_scalar(s, len, utf8_boundary(s, i), len);
+}
+#endif
+
+static size_t utf8_level(
+    enum scan_level level, const unsigned char* s, size_t len) {
+  switch (level) {
+#if CRAM_SCAN_X86
+    case SCAN_AVX2:
+      return utf8_avx2(s, len);
+    case SCAN_SSE2:
+      return utf8_sse2(s, len);
+#endif
+    default:
+      return utf8_scalar(s, len, 0, len);
+  }
+}
+
+/* Checks the text from where the last check stopped up to `to`, a line
+ * start or the end of the text.
+ */
+static void check_lines(struct Scanner* sc, size_t to) {
+  const unsigned char* s = (const unsigned char*)sc->buf + sc->checked;
+  size_t bad = sc->checked + utf8_level(sc->level, s, to - sc->checked);
+
+  if (bad < to)
+    sc->bad = bad;
+  else
+    sc->checked = to;
+}
+
+enum scan_level scan_detect(void) {
+  if (g_scan_detected)
+    return (g_scan_level < g_scan_limit) ? g_scan_level : g_scan_limit;
+
+  enum scan_level level = SCAN_SCALAR;
+
+#if CRAM_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    level = SCAN_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    level = SCAN_SSE2;
+#endif
+  g_scan_level = level;
+  g_scan_detected = 1;
+  return (level < g_scan_limit) ? level : g_scan_limit;
+}
+
+void scan_limit(enum scan_level level) {
+  g_scan_limit = level;
+}
+
+const char* scan_level_name(enum scan_level level) {
+  switch (level) {
+    case SCAN_AVX2:
+      return "avx2";
+    case SCAN_SSE2:
+      return "sse2";
+    default:
+      return "scalar";
+  }
+}
+
+int scan_start(struct Scanner* sc, const char* buf, size_t len) {
+  if (!validate_ptr(sc))
+    return -1;
+  if (!validate_ptr(buf))
+    return -1;
+  if (!validate_ok((u64)len <= MAX_DECK_BYTES))
+    return -1;
+
+  sc->buf = buf;
+  sc->len = len;
+  sc->pos = 0;
+  sc->done = 0;
+  sc->open_end = 0;
+  sc->level = scan_detect();
+  sc->checked = 0;
+  sc->bad = SCAN_NONE;
+  return 0;
+}
+
+static void emit_line(const char* buf,
+    size_t start,
+    size_t end,
+    size_t first,
+    struct ScanLine* out) {
+  size_t len = end - start;
+
+  if (len > 0 && buf[end - 1] == '\r')
+    len--;
+  out->start = start;
+  out->len = len;
+  out->first = (first != SCAN_NONE && first < start + len) ? first - start :
+                                                              len;
+}
+
+/* Fills `out` with up to `max` lines, SCAN_BLOCK bytes per mask step,
+ * checking them as UTF-8 every SCAN_CHECK_BYTES (see `bad`).
+ * As with a byte-wise split on '\n', the end of the text closes a
+ * (possibly empty) last line, unless `open_end` is set: then scanning
+ * stops after the last '\n' and `pos` marks the unfinished line.
+ * Returns 0 once every line was produced.
+ */
+size_t scan_lines(struct Scanner* sc, struct ScanLine* out, size_t max) {
+  if (!validate_ptr(sc))
+    return 0;
+  if (!validate_ptr(out))
+    return 0;
+  if (sc->done)
+    return 0;
+
+  const char* buf = sc->buf;
+  size_t len = sc->len;
+  size_t line_start = sc->pos;
+  size_t base = line_start;
+  size_t first = SCAN_NONE;
+  size_t n = 0;
+
+  for (u64 iter = 0; iter <= MAX_DECK_BYTES / SCAN_BLOCK + 1U; iter++) {
+    if (n >= max)
+      break;
+    if (base >= len) {
+      sc->done = 1;
+      if (sc->open_end)
+        break;
+      emit_line(buf, line_start, len, first, &out[n]);
+      n++;
+      line_start = len;
+      break;
+    }
+    size_t avail = len - base;
+
+    if (avail > SCAN_BLOCK)
+      avail = SCAN_BLOCK;
+    u64 nl = 0;
+    u64 nonws = 0;
+
+    block_masks(sc->level, buf + base, avail, &nl, &nonws);
+
+    size_t ls = (line_start > base) ? line_start - base : 0;
+
+    for (size_t k = 0; k <= SCAN_BLOCK; k++) {
+      if (first == SCAN_NONE && ls < SCAN_BLOCK) {
+        u64 cand = nonws & (~0ULL << ls);
+
+        if (cand)
+          first = base + lowest_bit(cand);
+      }
+      if (!nl || n >= max)
+        break;
+      size_t q = lowest_bit(nl);
+
+      nl &= nl - 1U;
+      emit_line(buf, line_start, base + q, first, &out[n]);
+      n++;
+      line_start = base + q + 1U;
+      ls = q + 1U;
+      first = SCAN_NONE;
+    }
+    if (n >= max)
+      break;
+    if (line_start - sc->checked >= SCAN_CHECK_BYTES &&
+        sc->bad == SCAN_NONE)
+      check_lines(sc, line_start);
+    base += avail;
+  }
+  if (line_start > sc->checked && sc->bad == SCAN_NONE)
+    check_lines(sc, line_start);
+  sc->pos = line_start;
+  return n;
+}
+
+size_t scan_utf8(enum scan_level level, const char* buf, size_t len) {
+  if (!validate_ptr(buf))
+    return 0;
+
+  return utf8_level(level, (const unsigned char*)buf, len);
+}
+
+size_t scan_line_length(const char* buf, size_t len, size_t start) {
+  if (!validate_ptr(buf))
+    return (size_t)MAX_LINE_LEN + 1U;
+  if (!validate_ok(start <= len))
+    return (size_t)MAX_LINE_LEN + 1U;
+
+  size_t window = len - start;
+
+  if (window > (size_t)MAX_LINE_LEN + 2U)
+    window = (size_t)MAX_LINE_LEN + 2U;
+
+  const char* nl = memchr(buf + start, '\n', window);
+  size_t end = nl ? (size_t)(nl - buf) : start + window;
+  size_t line_len = end - start;
+
+  if (!nl && end < len)
+    return (size_t)MAX_LINE_LEN + 1U;
+  if (line_len > 0 && buf[end - 1] == '\r')
+    line_len--;
+  return line_len;
+}
@@ -4,15 +4,39 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
+/* Synchronized output is asked about with DECRQM for mode 2026, then a
+ * primary device attributes request, which every terminal answers; an
+ * answer to the first before the second tells.
+ */
+#define TERM_PROBE_SEQ "\033[?2026$p\033[c"
+#define TERM_PROBE_REPLY "\033[?2026;"
+#define TERM_PROBE_MS 100
+#define TERM_PROBE_READS 8U
+#define TERM_PROBE_MAX 256U
+#define TERM_ERASE_BELOW "\033[J"
+/* ESC [ row ; col H, with up to 10 digits each. */
+#define TERM_MOVE_MAX 32U
+
+static u64 now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
 static int write_all(const char* buf, size_t len) {
   if (!assert_ptr(buf))
     return -1;
-  if (!assert_ok(len <= MAX_LINE_LEN))
+  if (!assert_ok(len <= TERM_FRAME_MAX))
     return -1;
 
   for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
@@ -35,6 +59,40 @@ static int write_all(const char* buf, size_t len) {
   return 0;
 }
 
+int term_attach_tty(char* err_buf, size_t err_len) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+  if (isatty(STDIN_FILENO))
+    return 0;
+
+  /* The deck came in on stdin; keys come from the controlling terminal. */
+  int fd = open("/dev/tty", O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    const char* err = strerror(errno);
+
+    if (!err)
+      err = "unknown error";
+    int rc = snprintf(err_buf, err_len, "Failed to open /dev/tty: %s", err);
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+
+  int rc = dup2(fd, STDIN_FILENO);
+  int close_rc = close(fd);
+
+  if (rc < 0 || close_rc != 0) {
+    rc = snprintf(err_buf, err_len, "Failed to attach /dev/tty");
+    if (rc < 0)
+      return -1;
+    return -1;
+  }
+  return 0;
+}
+
 int term_enter_raw(struct TermState* state, char* err_buf, size_t err_len) {
   if (!validate_ptr(state))
     return -1;
@@ -105,9 +163,7 @@ int term_restore(struct TermState* state) {
 }
 
 int term_clear_screen(void) {
-  const char* seq = "\033[2J\033[H";
-
-  return write_all(seq, strlen(seq));
+  return write_all(TERM_CLEAR_SEQ, TERM_CLEAR_LEN);
 }
 
 int term_hide_cursor(void) {
@@ -122,48 +178,439 @@ int term_show_cursor(void) {
   return write_all(seq, strlen(seq));
 }
 
-int term_read_key_timeout(int timeout_ms, int* out_key) {
-  if (!validate_ptr(out_key))
+static int read_size(struct TermScreen* screen) {
+  struct winsize ws;
+
+  screen->cols = 0;
+  screen->rows = 0;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0)
+    return 0;
+  screen->cols = ws.ws_col;
+  screen->rows = ws.ws_row;
+  return 0;
+}
+
+/* Scans the replies to TERM_PROBE_SEQ: *done once the device attributes
+ * (ESC [ ? ... c) have come, *sync if mode 2026 was reported set or reset
+ * (1 or 2; 0 is unknown, 4 permanently off).
+ */
+static void scan_probe(const char* buf, size_t len, int* sync, int* done) {
+  size_t mark = sizeof(TERM_PROBE_REPLY) - 1U;
+
+  for (size_t i = 0; i < TERM_PROBE_MAX; i++) {
+    if (i + 3U > len)
+      break;
+    if (buf[i] != '\033' || buf[i + 1U] != '[' || buf[i + 2U] != '?')
+      continue;
+    if (i + mark < len && memcmp(buf + i, TERM_PROBE_REPLY, mark) == 0) {
+      char mode = buf[i + mark];
+
+      if (mode == '1' || mode == '2')
+        *sync = 1;
+      continue;
+    }
+    for (size_t j = i + 3U; j < TERM_PROBE_MAX; j++) {
+      if (j >= len)
+        break;
+      if (buf[j] == 'c') {
+        *done = 1;
+        break;
+      }
+      if (buf[j] != ';' && (buf[j] < '0' || buf[j] > '9'))
+        break;
+    }
+  }
+}
+
+static int probe_sync(void) {
+  char buf[TERM_PROBE_MAX];
+  size_t len = 0;
+  int sync = 0;
+  int done = 0;
+
+  /* Only a terminal on both ends can answer. */
+  if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+    return 0;
+  if (write_all(TERM_PROBE_SEQ, sizeof(TERM_PROBE_SEQ) - 1U) != 0)
+    return 0;
+  for (size_t i = 0; i < TERM_PROBE_READS; i++) {
+    if (done || len >= sizeof(buf))
+      break;
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+
+    if (poll(&pfd, 1, TERM_PROBE_MS) <= 0)
+      break;
+
+    ssize_t n = read(STDIN_FILENO, buf + len, sizeof(buf) - len);
+
+    if (n <= 0)
+      break;
+    len += (size_t)n;
+    scan_probe(buf, len, &sync, &done);
+  }
+  return sync;
+}
+
+int term_screen_open(struct TermScreen* screen) {
+  if (!validate_ptr(screen))
+    return -1;
+
+  screen->len = 0;
+  screen->valid = 0;
+  screen->fits = 0;
+  screen->serial = 1;
+  screen->out_fd = -1;
+  screen->out_pos = 0;
+  screen->out_len = 0;
+  screen->next_ready = 0;
+  screen->stall_start_ns = 0;
+  screen->frames = 0;
+  screen->diffs = 0;
+  screen->dropped = 0;
+  screen->writes = 0;
+  screen->bytes = 0;
+  screen->stalled_ns = 0;
+  screen->max_stall_ns = 0;
+  screen->sync = probe_sync();
+  if (read_size(screen) != 0)
+    return -1;
+
+  /* O_NONBLOCK belongs to an open file, and stdout's may be shared with
+   * stdin and the shell, so output gets an open file of its own. Output
+   * that is no terminal is written blocking.
+   */
+  if (!isatty(STDOUT_FILENO)) {
+    screen->out_fd = STDOUT_FILENO;
+    return 0;
+  }
+
+  const char* tty = ttyname(STDOUT_FILENO);
+
+  if (!tty)
+    return -1;
+  screen->out_fd = open(tty, O_WRONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (screen->out_fd < 0)
+    return -1;
+  return 0;
+}
+
+static void end_stall(struct TermScreen* screen) {
+  if (screen->stall_start_ns == 0)
+    return;
+
+  u64 stall = now_ns() - screen->stall_start_ns;
+
+  screen->stalled_ns += stall;
+  if (stall > screen->max_stall_ns)
+    screen->max_stall_ns = stall;
+  screen->stall_start_ns = 0;
+}
+
+int term_screen_close(struct TermScreen* screen) {
+  if (!validate_ptr(screen))
+    return -1;
+  if (screen->out_fd < 0)
+    return 0;
+
+  int rc = 0;
+
+  if (screen->out_fd != STDOUT_FILENO && close(screen->out_fd) != 0)
+    rc = -1;
+  screen->out_fd = -1;
+  /* A frame cut short could leave the terminal inside an escape
+   * sequence.
+   */
+  if (rc == 0 && screen->out_pos < screen->out_len)
+    rc = write_all(
+        screen->out + screen->out_pos, screen->out_len - screen->out_pos);
+  screen->out_pos = 0;
+  screen->out_len = 0;
+  screen->next_ready = 0;
+  end_stall(screen);
+  return rc;
+}
+
+/* Whether text drawn from the top left stays where it was drawn. Bytes
+ * bound the cells UTF-8 text takes, and the newline takes a row.
+ */
+static int text_fits(const struct TermScreen* screen,
+    const char* text,
+    size_t len) {
+  if (screen->cols == 0 || screen->rows == 0)
+    return 0;
+  if (len / screen->cols + 2U > screen->rows)
+    return 0;
+
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (i >= len)
+      break;
+    unsigned char ch = (unsigned char)text[i];
+
+    if (ch < 0x20 || ch == 0x7f)
+      return 0;
+  }
+  return 1;
+}
+
+/* Bytes the new prompt shares with the one on screen, cut to printable
+ * ASCII so that each takes one cell and the position after them is
+ * known.
+ */
+static size_t shared_prefix(const struct TermScreen* screen,
+    const char* text,
+    size_t len) {
+  size_t limit = (len < screen->len) ? len : screen->len;
+  size_t prefix = 0;
+
+  for (size_t i = 0; i < MAX_LINE_LEN; i++) {
+    if (i >= limit)
+      break;
+    unsigned char ch = (unsigned char)text[i];
+
+    if (ch != (unsigned char)screen->text[i] || ch < 0x20 || ch >= 0x7f)
+      break;
+    prefix = i + 1U;
+  }
+  return prefix;
+}
+
+static size_t put_bytes(char* out, size_t at, const char* bytes, size_t len) {
+  memcpy(out + at, bytes, len);
+  return at + len;
+}
+
+int term_build_frame(const struct TermScreen* screen,
+    struct TermFrame* frame,
+    const char* text,
+    size_t len) {
+  if (!validate_ptr(screen))
     return -1;
-  if (!validate_ok(timeout_ms >= -1))
+  if (!validate_ptr(frame))
+    return -1;
+  if (!validate_ptr(text))
+    return -1;
+  if (!validate_ok(len <= MAX_LINE_LEN))
     return -1;
 
-  fd_set readfds;
+  char move[TERM_MOVE_MAX];
+  size_t move_len = 0;
+  size_t prefix = 0;
+  size_t erase_len = sizeof(TERM_ERASE_BELOW) - 1U;
+  size_t begin_len = sizeof(TERM_SYNC_BEGIN) - 1U;
+  size_t end_len = sizeof(TERM_SYNC_END) - 1U;
 
-  FD_ZERO(&readfds);
-  FD_SET(STDIN_FILENO, &readfds);
+  if (screen->valid && screen->fits) {
+    prefix = shared_prefix(screen, text, len);
 
-  struct timeval tv;
-  struct timeval* tv_ptr = NULL;
+    int rc = snprintf(move,
+        sizeof(move),
+        "\033[%u;%uH",
+        (unsigned int)(prefix / screen->cols) + 1U,
+        (unsigned int)(prefix % screen->cols) + 1U);
 
-  if (timeout_ms >= 0) {
-    tv.tv_sec = timeout_ms / 1000;
-    tv.tv_usec = (timeout_ms % 1000) * 1000;
-    tv_ptr = &tv;
+    if (!assert_ok(rc > 0 && (size_t)rc < sizeof(move)))
+      return -1;
+    move_len = (size_t)rc;
   }
 
-  int ready = select(STDIN_FILENO + 1, &readfds, NULL, NULL, tv_ptr);
+  /* Only worth it when the move and erase cost less than what they
+   * spare.
+   */
+  int diff = move_len > 0 && move_len + erase_len < TERM_CLEAR_LEN + prefix;
+  size_t at = 0;
+
+  if (screen->sync)
+    at = put_bytes(frame->bytes, at, TERM_SYNC_BEGIN, begin_len);
+  if (diff) {
+    at = put_bytes(frame->bytes, at, move, move_len);
+    at = put_bytes(frame->bytes, at, TERM_ERASE_BELOW, erase_len);
+  } else {
+    prefix = 0;
+    at = put_bytes(frame->bytes, at, TERM_CLEAR_SEQ, TERM_CLEAR_LEN);
+  }
+  at = put_bytes(frame->bytes, at, text + prefix, len - prefix);
+  frame->bytes[at++] = '\n';
+  if (screen->sync)
+    at = put_bytes(frame->bytes, at, TERM_SYNC_END, end_len);
+
+  /* A waiting frame is rebuilt from its own text. */
+  if (frame->text != text)
+    memcpy(frame->text, text, len);
+  frame->text_len = len;
+  frame->len = at;
+  frame->base = screen->serial;
+  frame->diff = diff;
+  return 0;
+}
+
+int term_frame_fresh(const struct TermScreen* screen,
+    const struct TermFrame* frame) {
+  if (!validate_ptr(screen))
+    return 0;
+  if (!validate_ptr(frame))
+    return 0;
+
+  return frame->base == screen->serial;
+}
 
-  if (ready < 0) {
-    if (errno == EINTR)
+/* Writes what the terminal takes now of buf; *written says how much. */
+static int write_some(struct TermScreen* screen,
+    const char* buf,
+    size_t len,
+    size_t* written) {
+  *written = 0;
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    if (*written >= len)
+      break;
+    ssize_t n = write(screen->out_fd, buf + *written, len - *written);
+
+    screen->writes++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      return -1;
+    }
+    if (n == 0)
       return 0;
+    *written += (size_t)n;
+    screen->bytes += (u64)n;
+  }
+  return 0;
+}
+
+/* Starts writing a frame; from then on it is what is on screen, and what
+ * the terminal does not take at once is queued.
+ */
+static int send_frame(struct TermScreen* screen,
+    const struct TermFrame* frame) {
+  size_t written = 0;
+
+  screen->serial++;
+  if (write_some(screen, frame->bytes, frame->len, &written) != 0) {
+    /* Part of the frame may be on screen. */
+    screen->valid = 0;
     return -1;
   }
-  if (ready == 0)
+  memcpy(screen->text, frame->text, frame->text_len);
+  screen->len = frame->text_len;
+  screen->valid = 1;
+  screen->fits = text_fits(screen, frame->text, frame->text_len);
+  screen->frames++;
+  screen->diffs += (u64)frame->diff;
+  if (written == frame->len)
     return 0;
-  if (!assert_ok(ready == 1))
+
+  memcpy(screen->out, frame->bytes + written, frame->len - written);
+  screen->out_pos = 0;
+  screen->out_len = frame->len - written;
+  if (screen->stall_start_ns == 0)
+    screen->stall_start_ns = now_ns();
+  return 0;
+}
+
+/* Rebuilds the waiting frame against the screen if the screen changed
+ * under it (a resize), so that it still draws what it was queued for.
+ */
+static int refresh_next(struct TermScreen* screen) {
+  struct TermFrame* next = &screen->next;
+
+  if (term_frame_fresh(screen, next))
+    return 0;
+  return term_build_frame(screen, next, next->text, next->text_len);
+}
+
+int term_screen_resize(struct TermScreen* screen) {
+  if (!validate_ptr(screen))
+    return -1;
+
+  int drawn = screen->valid;
+
+  screen->valid = 0;
+  screen->serial++;
+  if (read_size(screen) != 0)
+    return -1;
+  if (screen->next_ready)
+    return refresh_next(screen);
+  if (!drawn)
+    return 0;
+
+  /* Draw what is on screen again, at the new size. */
+  struct TermFrame* next = &screen->next;
+
+  if (term_build_frame(screen, next, screen->text, screen->len) != 0)
+    return -1;
+  if (screen->out_pos == screen->out_len)
+    return send_frame(screen, next);
+  screen->next_ready = 1;
+  return 0;
+}
+
+int term_write_frame(struct TermScreen* screen, const struct TermFrame* frame) {
+  if (!validate_ptr(screen))
     return -1;
-  if (!assert_ok(FD_ISSET(STDIN_FILENO, &readfds)))
+  if (!validate_ptr(frame))
     return -1;
+  if (!assert_ok(term_frame_fresh(screen, frame)))
+    return -1;
+
+  if (screen->out_pos == screen->out_len)
+    return send_frame(screen, frame);
+
+  /* Behind: the frame waits, in place of one that was waiting. */
+  struct TermFrame* next = &screen->next;
+
+  if (screen->next_ready)
+    screen->dropped++;
+  memcpy(next->bytes, frame->bytes, frame->len);
+  memcpy(next->text, frame->text, frame->text_len);
+  next->len = frame->len;
+  next->text_len = frame->text_len;
+  next->base = frame->base;
+  next->diff = frame->diff;
+  screen->next_ready = 1;
+  return 0;
+}
+
+int term_flush(struct TermScreen* screen) {
+  if (!validate_ptr(screen))
+    return -1;
+  if (screen->out_pos == screen->out_len)
+    return 0;
 
-  unsigned char ch = 0;
-  ssize_t n = read(STDIN_FILENO, &ch, 1);
+  size_t written = 0;
+  size_t left = screen->out_len - screen->out_pos;
 
-  if (n == 1) {
-    *out_key = (int)ch;
-    return 1;
+  if (write_some(screen, screen->out + screen->out_pos, left, &written) != 0)
+    return -1;
+  screen->out_pos += written;
+  if (written < left)
+    return 0;
+  screen->out_pos = 0;
+  screen->out_len = 0;
+  if (screen->next_ready) {
+    screen->next_ready = 0;
+    if (refresh_next(screen) != 0)
+      return -1;
+    if (send_frame(screen, &screen->next) != 0)
+      return -1;
   }
-  if (n < 0 && errno == EINTR)
+  if (screen->out_pos == screen->out_len)
+    end_stall(screen);
+  return 0;
+}
+
+int term_output_pending(const struct TermScreen* screen) {
+  if (!validate_ptr(screen))
     return 0;
-  return -1;
+
+  return screen->out_pos < screen->out_len;
+}
+
+int term_output_fd(const struct TermScreen* screen) {
+  if (!validate_ptr(screen))
+    return -1;
+
+  return screen->out_fd;
 }
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: MIT
+#include "watch.h"
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_PATH_MAX 512U
+#define WATCH_EVENT_BUF 4096U
+
+static int set_error(char* err_buf, size_t err_len, const char* msg) {
+  if (!validate_ptr(err_buf))
+    return -1;
+  if (!validate_ok(err_len > 0))
+    return -1;
+
+  int rc = snprintf(err_buf, err_len, "%s", msg);
+
+  if (rc < 0)
+    return -1;
+  return -1;
+}
+
+int watch_open(
+    struct Watch* watch, const char* path, char* err_buf, size_t err_len) {
+  if (!validate_ptr(watch))
+    return -1;
+  if (!validate_ptr(path))
+    return -1;
+
+  const char* slash = strrchr(path, '/');
+  const char* name = slash ? slash + 1 : path;
+  char dir[WATCH_PATH_MAX];
+  int rc = 0;
+
+  if (!slash)
+    rc = snprintf(dir, sizeof(dir), ".");
+  else if (slash == path)
+    rc = snprintf(dir, sizeof(dir), "/");
+  else
+    rc = snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+  if (rc < 0 || (size_t)rc >= sizeof(dir))
+    return set_error(err_buf, err_len, "watched path too long");
+  rc = snprintf(watch->name, sizeof(watch->name), "%s", name);
+  if (rc <= 0 || (size_t)rc >= sizeof(watch->name))
+    return set_error(err_buf, err_len, "watched path has no file name");
+
+  watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch->fd < 0)
+    return set_error(err_buf, err_len, "failed to start watching the deck");
+  if (inotify_add_watch(watch->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    (void)close(watch->fd);
+    watch->fd = -1;
+    return set_error(err_buf, err_len, "failed to watch the deck directory");
+  }
+  watch->path = path;
+  return 0;
+}
+
+int watch_drain(struct Watch* watch, int* changed) {
+  if (!validate_ptr(watch))
+    return -1;
+  if (!validate_ptr(changed))
+    return -1;
+  if (!assert_ok(watch->fd >= 0))
+    return -1;
+
+  /* Aligned for struct inotify_event. */
+  union {
+    struct inotify_event event;
+    char bytes[WATCH_EVENT_BUF];
+  } buf;
+
+  *changed = 0;
+  for (size_t i = 0; i < MAX_WRITE_LOOPS; i++) {
+    ssize_t n = read(watch->fd, buf.bytes, sizeof(buf.bytes));
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      return 0;
+    if (n <= 0)
+      return -1;
+
+    size_t pos = 0;
+
+    for (size_t k = 0; k < WATCH_EVENT_BUF; k++) {
+      if (pos + sizeof(struct inotify_event) > (size_t)n)
+        break;
+
+      struct inotify_event ev;
+
+      memcpy(&ev, buf.bytes + pos, sizeof(ev));
+
+      const char* ev_name = buf.bytes + pos + sizeof(ev);
+
+      if (ev.len > 0 && strncmp(ev_name, watch->name, ev.len) == 0)
+        *changed = 1;
+      pos += sizeof(ev) + ev.len;
+    }
+  }
+  return -1;
+}
+
+int watch_close(struct Watch* watch) {
+  if (!validate_ptr(watch))
+    return -1;
+  if (watch->fd < 0)
+    return 0;
+
+  int rc = close(watch->fd);
+
+  watch->fd = -1;
+  return (rc == 0) ? 0 : -1;
+}